@@ -1,4 +1,10 @@
 #include "assimp.h"
+#include "culling.h"
+#include "lod.h"
+#include "meshcache.h"
+#include "meshoptimization.h"
+#include "profiler.h"
+#include "vertexcompression.h"
 
 void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
 {
@@ -61,28 +67,29 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
 
     // Create the vertex format
     VertexBufferLayout vertexBufferLayout = {};
-    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 0, 3, 0 } );                // 3D positions
-    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 1, 3, 3*sizeof(float) } );  // Normal
+    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 0, 3, 0, GL_FLOAT, GL_FALSE } );                // 3D positions
+    vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 1, 3, 3*sizeof(float), GL_FLOAT, GL_FALSE } );  // Normal
     vertexBufferLayout.stride = 6 * sizeof(float);
 
     if (hasTexCoords)
     {
-        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride } );
+        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride, GL_FLOAT, GL_FALSE } );
         vertexBufferLayout.stride += 2 * sizeof(float);
     }
 
     if (hasTangentSpace)
     {
-        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride } );
+        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride, GL_FLOAT, GL_FALSE } );
         vertexBufferLayout.stride += 3 * sizeof(float);
 
-        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride } );
+        vertexBufferLayout.attributes.push_back( VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride, GL_FLOAT, GL_FALSE } );
         vertexBufferLayout.stride += 3 * sizeof(float);
     }
 
     // Add the submesh into the mesh
     Submesh submesh = {};
     submesh.vertexBufferLayout = vertexBufferLayout;
+    submesh.bounds = ComputeBoundingVolume(vertices.data(), mesh->mNumVertices, vertexBufferLayout.stride / sizeof(float));
     submesh.vertices.swap(vertices);
     submesh.indices.swap(indices);
     myMesh->submeshes.push_back(submesh);
@@ -105,6 +112,7 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
     myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
     myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
     myMaterial.smoothness = shininess / 256.0f;
+    myMaterial.specular = glm::clamp(glm::max(glm::max(specularColor.r, specularColor.g), specularColor.b), 0.0f, 1.0f);
 
     aiString aiFilename;
     if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
@@ -162,15 +170,35 @@ void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 bas
     }
 }
 
-u32 LoadModel(App* app, const char* filename)
+static void SetMeshResidency(App* app, u32 modelIdx, bool keepCpuData)
 {
+    Mesh& mesh = app->meshes[app->models[modelIdx].meshIdx];
+    mesh.keepCpuData = keepCpuData;
+    if (!keepCpuData)
+        ReleaseMeshCpuData(mesh);
+}
+
+u32 LoadModel(App* app, const char* filename, bool keepCpuData)
+{
+    PROFILE_SCOPE("LoadModel");
+
+    const u64 startTimestamp = GetTimestampNs();
+    const String cachePath = MakeCachePath(filename, ".mesh");
+
+    u32 cachedModelIdx = LoadModelCache(app, filename, cachePath.str);
+    if (cachedModelIdx != UINT32_MAX)
+    {
+        ILOG("Loaded model %s from %s in %.2f ms", filename, cachePath.str, (GetTimestampNs() - startTimestamp) / 1000000.0);
+        SetMeshResidency(app, cachedModelIdx, keepCpuData);
+        return cachedModelIdx;
+    }
+
     const aiScene* scene = aiImportFile(filename,
                                         aiProcess_Triangulate           |
                                         aiProcess_GenSmoothNormals      |
                                         aiProcess_CalcTangentSpace      |
                                         aiProcess_JoinIdenticalVertices |
                                         aiProcess_PreTransformVertices  |
-                                        aiProcess_ImproveCacheLocality  |
                                         aiProcess_OptimizeMeshes        |
                                         aiProcess_SortByPType);
 
@@ -182,6 +210,7 @@ u32 LoadModel(App* app, const char* filename)
 
     app->meshes.push_back(Mesh{});
     Mesh& mesh = app->meshes.back();
+    mesh.name = filename;
     u32 meshIdx = (u32)app->meshes.size() - 1u;
 
     app->models.push_back(Model{});
@@ -204,43 +233,91 @@ u32 LoadModel(App* app, const char* filename)
 
     aiReleaseImport(scene);
 
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
+    // Stats of the whole mesh, weighted by the triangles (or vertices) of each submesh
+    MeshOptimizationStats statsBefore = {};
+    MeshOptimizationStats statsAfter = {};
+    u64 triangleCount = 0;
+    u64 vertexCount = 0;
+    u64 vertexBytes = 0;
+    u64 lodTriangleCounts[MAX_LODS] = {};
+    u64 indexBytes = 0;
+    u64 indexBytesSaved = 0;
+    u32 shortIndexSubmeshes = 0;
+
+#if VERTEX_COMPRESSION
+    // The positions of all the submeshes are quantized in the box of the whole mesh
+    BoundingVolume floatBounds = {};
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        floatBounds = i == 0 ? mesh.submeshes[i].bounds : MergeBoundingVolumes(floatBounds, mesh.submeshes[i].bounds);
+    ComputePositionDequantization(floatBounds, mesh.positionOffset, mesh.positionScale);
+#endif
 
     for (u32 i = 0; i < mesh.submeshes.size(); ++i)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize  += mesh.submeshes[i].indices.size()  * sizeof(u32);
+        Submesh& submesh = mesh.submeshes[i];
+
+        // Optimized on the float vertices, before quantization moves the positions around
+        MeshOptimizationStats before, after;
+        OptimizeSubmesh(submesh, &before, &after);
+
+        const u32 submeshTriangles = submesh.indices.size() / 3;
+        const u32 submeshVertices = submesh.vertices.size() * sizeof(float) / submesh.vertexBufferLayout.stride;
+        statsBefore.acmr += before.acmr * submeshTriangles;
+        statsBefore.atvr += before.atvr * submeshVertices;
+        statsBefore.overdraw += before.overdraw * submeshTriangles;
+        statsAfter.acmr += after.acmr * submeshTriangles;
+        statsAfter.atvr += after.atvr * submeshVertices;
+        statsAfter.overdraw += after.overdraw * submeshTriangles;
+        triangleCount += submeshTriangles;
+
+        // The levels of detail reuse the optimized vertices, and only add indices
+        GenerateSubmeshLods(submesh);
+        for (u32 lod = 0; lod < MAX_LODS; ++lod)
+            lodTriangleCounts[lod] += GetSubmeshLod(submesh, lod).indexCount / 3;
+
+        // Chosen once the vertices and indices are final
+        submesh.indexType = ChooseIndexType(submeshVertices);
+        indexBytes += submesh.indices.size() * GetIndexTypeSize(submesh.indexType);
+        indexBytesSaved += submesh.indices.size() * (sizeof(u32) - GetIndexTypeSize(submesh.indexType));
+        shortIndexSubmeshes += submesh.indexType == GL_UNSIGNED_SHORT;
+
+#if VERTEX_COMPRESSION
+        CompressSubmeshVertices(submesh, mesh.positionOffset, mesh.positionScale);
+#endif
+
+        AddSubmeshToArena(app, submesh);
+
+        vertexBytes += submesh.vertices.size() * sizeof(float);
+        vertexCount += submeshVertices;
+
+        const BoundingVolume& submeshBounds = submesh.bounds;
+        mesh.bounds = i == 0 ? submeshBounds : MergeBoundingVolumes(mesh.bounds, submeshBounds);
     }
 
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
-
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
-
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    if (triangleCount > 0 && vertexCount > 0)
     {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
+        ILOG("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f", filename,
+             statsBefore.acmr / triangleCount, statsAfter.acmr / triangleCount,
+             statsBefore.atvr / vertexCount, statsAfter.atvr / vertexCount,
+             statsBefore.overdraw / triangleCount, statsAfter.overdraw / triangleCount);
+    }
 
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
+    char lodLog[128] = "";
+    for (u32 lod = 0; lod < MAX_LODS; ++lod)
+    {
+        const u32 length = strlen(lodLog);
+        snprintf(lodLog + length, sizeof(lodLog) - length, lod == 0 ? "%llu" : " / %llu", (unsigned long long)lodTriangleCounts[lod]);
     }
+    ILOG("%s: triangles per level of detail %s", filename, lodLog);
+    ILOG("%s: %u of %u submeshes with 16-bit indices, %.1f KB of indices (%.1f KB saved)", filename, shortIndexSubmeshes,
+         (u32)mesh.submeshes.size(), indexBytes / 1024.0, indexBytesSaved / 1024.0);
+
+    ILOG("Imported model %s with assimp in %.2f ms", filename, (GetTimestampNs() - startTimestamp) / 1000000.0);
+    ILOG("%s: %llu vertices, %.1f bytes per vertex%s", filename, (unsigned long long)vertexCount,
+         vertexCount ? (f64)vertexBytes / vertexCount : 0.0, VERTEX_COMPRESSION ? " (compressed)" : "");
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    SaveModelCache(app, filename, cachePath.str, modelIdx);
+    SetMeshResidency(app, modelIdx, keepCpuData);
 
     return modelIdx;
 }
\ No newline at end of file
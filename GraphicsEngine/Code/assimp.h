@@ -12,4 +12,5 @@ void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial,
 
 void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
 
-u32 LoadModel(App* app, const char* filename);
\ No newline at end of file
+// The CPU copies of the vertices and indices are released once uploaded, unless keepCpuData is set
+u32 LoadModel(App* app, const char* filename, bool keepCpuData = false);
\ No newline at end of file
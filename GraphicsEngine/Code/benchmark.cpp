@@ -0,0 +1,281 @@
+#include "benchmark.h"
+#include "gputimers.h"
+#include "lighting.h"
+
+#include <algorithm>
+#include <thread>
+
+#define BENCHMARK_ENTITY_SPACING 3.0f
+#define BENCHMARK_ORBIT_PERIOD   10.0f  // seconds per turn around the scene
+
+static const char* BenchmarkModeNames[] = { "quad", "forward", "deferred" };
+static const char* BenchmarkSubmissionNames[] = { "per-entity", "instanced", "indirect" };
+
+// xorshift32, so the scene is the same on every platform and standard library
+static f32 RandomFloat(u32& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+bool ParseBenchmarkMode(const char* name, Mode& mode)
+{
+    for (u32 i = 0; i < ARRAY_COUNT(BenchmarkModeNames); ++i)
+    {
+        if (strcmp(name, BenchmarkModeNames[i]) == 0)
+        {
+            mode = (Mode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseBenchmarkSubmission(const char* name, Submission& submission)
+{
+    for (u32 i = 0; i < ARRAY_COUNT(BenchmarkSubmissionNames); ++i)
+    {
+        if (strcmp(name, BenchmarkSubmissionNames[i]) == 0)
+        {
+            submission = (Submission)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static u64 GetUploadedBytes(const App* app)
+{
+    return app->cbuffer.bytesWritten + app->instanceBuffer.bytesWritten + app->indirectBuffer.bytesWritten +
+           app->lightBuffer.bytesWritten + app->textureBytesUploaded;
+}
+
+bool InitSceneBenchmark(App* app, SceneBenchmark& benchmark, const BenchmarkConfig& config)
+{
+    benchmark = SceneBenchmark();
+    benchmark.config = config;
+    benchmark.config.materialCount = glm::max(config.materialCount, 1u);
+
+    u32 random = config.seed ? config.seed : 1;
+
+    app->mode = config.mode;
+    app->submission = config.submission;
+
+    // Copies of the model with tinted materials, the first one being the original
+    std::vector<u32> modelIndices(1, app->model);
+    for (u32 i = 1; i < benchmark.config.materialCount; ++i)
+    {
+        Model model = app->models[app->model];
+        const vec3 tint = vec3(RandomFloat(random), RandomFloat(random), RandomFloat(random)) * 0.5f + vec3(0.5f);
+
+        for (u32 j = 0; j < model.materialIdx.size(); ++j)
+        {
+            Material material = app->materials[model.materialIdx[j]];
+            material.albedo *= tint;
+            app->materials.push_back(material);
+            model.materialIdx[j] = app->materials.size() - 1;
+        }
+
+        app->models.push_back(model);
+        modelIndices.push_back(app->models.size() - 1);
+    }
+
+    // Every entity may be visible at once, and all of them must fit in the buffers of the submission method
+    const u32 maxEntities = GetMaxSubmittedEntities(app, config.submission);
+    if (config.entityCount > maxEntities)
+    {
+        ELOG("The benchmark can't submit %u entities per frame with this submission method, the maximum is %u", config.entityCount, maxEntities);
+        return false;
+    }
+
+    // BuildLightClusters drops the lights past MAX_LIGHTS, the directional light takes one of them
+    if (config.lightCount > MAX_LIGHTS - 1)
+    {
+        ELOG("The benchmark can't render %u point lights, the maximum is %u", config.lightCount, MAX_LIGHTS - 1);
+        return false;
+    }
+
+    // Entities in a square grid on the XZ plane
+    app->entities.clear();
+    app->worldMatrices.clear();
+
+    const u32 side = (u32)glm::ceil(glm::sqrt((f32)config.entityCount));
+    const f32 extent = side * BENCHMARK_ENTITY_SPACING;
+    const vec3 origin = vec3(-0.5f * extent, 0.0f, -0.5f * extent);
+
+    for (u32 i = 0; i < config.entityCount; ++i)
+    {
+        const vec3 position = origin + vec3((i % side + 0.5f) * BENCHMARK_ENTITY_SPACING, 1.0f, (i / side + 0.5f) * BENCHMARK_ENTITY_SPACING);
+        AddEntity(app, glm::translate(glm::mat4(1.0f), position), modelIndices[i % modelIndices.size()]);
+    }
+
+    // A directional light plus the point lights spread over the grid
+    app->lights.clear();
+    app->lights.push_back(Light(LightType_Directional, vec3(0.3f), vec3(1.0f, 1.0f, 0.0f), vec3(0.0f)));
+
+    for (u32 i = 0; i < config.lightCount; ++i)
+    {
+        const vec3 color = glm::normalize(vec3(RandomFloat(random), RandomFloat(random), RandomFloat(random)) + vec3(0.1f));
+        const vec3 position = origin + vec3(RandomFloat(random) * extent, 0.5f + 3.5f * RandomFloat(random), RandomFloat(random) * extent);
+        const f32 radius = BENCHMARK_ENTITY_SPACING * (1.0f + RandomFloat(random));
+        app->lights.push_back(Light(LightType_Point, color, vec3(0.0f), position, radius));
+    }
+
+    // The GPU timers count the frames rendered from 1, and the benchmark renders the first one
+    benchmark.firstMeasuredGpuFrame = config.warmupFrames + 1;
+
+    benchmark.sceneCenter = vec3(0.0f, 1.0f, 0.0f);
+    benchmark.sceneRadius = 0.5f * extent + 5.0f;
+
+    // Textures streaming in while measuring would make the first frames depend on the loader threads
+    app->textureUploadBudgetMs = 1000.0f;
+    while (!app->textureLoads.empty())
+    {
+        UpdateTextureLoads(app);
+        std::this_thread::yield();
+    }
+
+    benchmark.lastUploadedBytes = GetUploadedBytes(app);
+
+    ILOG("Benchmark scene: %u entities, %u point lights, %u materials, %u frames", config.entityCount, config.lightCount,
+         benchmark.config.materialCount, config.frameCount);
+    return true;
+}
+
+void BeginBenchmarkFrame(App* app, SceneBenchmark& benchmark)
+{
+    // Orbits the grid while moving closer and back out, so culling and sorting change every frame
+    const f32 time = benchmark.frameIdx * benchmark.config.deltaTime;
+    const f32 angle = glm::two_pi<f32>() * time / BENCHMARK_ORBIT_PERIOD;
+    const f32 distance = benchmark.sceneRadius * (0.6f + 0.4f * glm::cos(angle * 0.5f));
+
+    app->cameraPosition = benchmark.sceneCenter + vec3(glm::sin(angle) * distance, 2.0f + 0.3f * distance, glm::cos(angle) * distance);
+    app->cameraTarget = benchmark.sceneCenter;
+    app->deltaTime = benchmark.config.deltaTime;
+}
+
+void EndBenchmarkFrame(App* app, SceneBenchmark& benchmark, u64 cpuFrameNs)
+{
+    const u64 uploadedBytes = GetUploadedBytes(app);
+    const u64 frameUploadedBytes = uploadedBytes - benchmark.lastUploadedBytes;
+    benchmark.lastUploadedBytes = uploadedBytes;
+
+    const bool measured = benchmark.frameIdx >= benchmark.config.warmupFrames;
+    benchmark.frameIdx++;
+
+    if (!measured)
+        return;
+
+    benchmark.cpuFrameMs.push_back(cpuFrameNs / 1e6f);
+    benchmark.drawCalls.push_back((f32)app->drawCalls);
+    benchmark.stateBinds.push_back((f32)app->glState.bindsIssued);
+    benchmark.uploadedBytes.push_back((f32)frameUploadedBytes);
+
+    // The GPU times arrive a few frames late, each frame read back counts once
+    const u32 gpuResultsFrame = GetGpuTimerResultsFrame();
+    if (gpuResultsFrame != benchmark.lastGpuResultsFrame && gpuResultsFrame >= benchmark.firstMeasuredGpuFrame)
+    {
+        const std::vector<GpuTimerResult>& results = GetGpuTimerResults();
+
+        f32 gpuMs = 0.0f;
+        for (u32 i = 0; i < results.size(); ++i)
+        {
+            if (results[i].depth == 0)
+                gpuMs += results[i].gpuMs;
+        }
+
+        benchmark.gpuFrameMs.push_back(gpuMs);
+    }
+    benchmark.lastGpuResultsFrame = gpuResultsFrame;
+}
+
+u32 GetBenchmarkFrameCount(const SceneBenchmark& benchmark)
+{
+    return benchmark.config.warmupFrames + benchmark.config.frameCount;
+}
+
+static void WriteJsonString(FILE* file, const char* str)
+{
+    fputc('"', file);
+    for (const char* c = str; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(file, "\\%c", *c);
+        else if ((u8)*c < 0x20)
+            fprintf(file, "\\u%04x", *c);
+        else
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+static f32 Percentile(const std::vector<f32>& sortedValues, f32 percentile)
+{
+    return sortedValues[(u32)(percentile * (sortedValues.size() - 1) + 0.5f)];
+}
+
+static void WriteJsonStats(FILE* file, const char* name, std::vector<f32> values)
+{
+    fprintf(file, "  \"%s\": {", name);
+
+    if (!values.empty())
+    {
+        std::sort(values.begin(), values.end());
+
+        f64 sum = 0.0;
+        for (u32 i = 0; i < values.size(); ++i)
+            sum += values[i];
+
+        fprintf(file, "\"samples\": %u, \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"total\": %.4f",
+                (u32)values.size(), sum / values.size(), values.front(), Percentile(values, 0.50f), Percentile(values, 0.95f),
+                Percentile(values, 0.99f), values.back(), sum);
+    }
+    else
+    {
+        fprintf(file, "\"samples\": 0");
+    }
+
+    fprintf(file, "},\n");
+}
+
+bool WriteBenchmarkResults(App* app, const SceneBenchmark& benchmark)
+{
+    const BenchmarkConfig& config = benchmark.config;
+
+    FILE* file = fopen(config.outputPath, "wb");
+    if (!file)
+    {
+        ELOG("Could not write the benchmark results to %s", config.outputPath);
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"scene\": {\"entities\": %u, \"lights\": %u, \"materials\": %u, \"frames\": %u, \"warmupFrames\": %u, "
+                  "\"deltaTime\": %.6f, \"seed\": %u, \"resolution\": [%d, %d], \"mode\": \"%s\", \"submission\": \"%s\"},\n",
+            config.entityCount, config.lightCount, config.materialCount, config.frameCount, config.warmupFrames, config.deltaTime,
+            config.seed, app->displaySize.x, app->displaySize.y, BenchmarkModeNames[(u32)config.mode],
+            BenchmarkSubmissionNames[(u32)config.submission]);
+
+    fprintf(file, "  \"device\": {\"vendor\": ");
+    WriteJsonString(file, (const char*)glGetString(GL_VENDOR));
+    fprintf(file, ", \"renderer\": ");
+    WriteJsonString(file, (const char*)glGetString(GL_RENDERER));
+    fprintf(file, ", \"version\": ");
+    WriteJsonString(file, (const char*)glGetString(GL_VERSION));
+    fprintf(file, "},\n");
+
+    WriteJsonStats(file, "cpuFrameMs", benchmark.cpuFrameMs);
+    WriteJsonStats(file, "gpuFrameMs", benchmark.gpuFrameMs);
+    WriteJsonStats(file, "drawCalls", benchmark.drawCalls);
+    WriteJsonStats(file, "stateBinds", benchmark.stateBinds);
+    WriteJsonStats(file, "uploadedBytes", benchmark.uploadedBytes);
+    fprintf(file, "  \"peakMemoryBytes\": %llu\n", (unsigned long long)GetPeakMemoryUsage());
+    fprintf(file, "}\n");
+
+    fclose(file);
+
+    ILOG("Benchmark results written to %s", config.outputPath);
+    return true;
+}
@@ -0,0 +1,69 @@
+//
+// benchmark.h: Deterministic scene benchmark. It replaces the scene loaded by Init()
+// with a synthetic one (a grid of Patrick entities, random point lights and tinted
+// copies of its materials), flies the camera along a fixed path with a fixed time
+// step, and writes the frame statistics as JSON so builds can be compared.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define BENCHMARK_DEFAULT_OUTPUT "benchmark.json"
+#define BENCHMARK_WARMUP_FRAMES  30     // rendered before measuring, not included in the results
+
+struct BenchmarkConfig
+{
+    u32         entityCount = 1000;
+    u32         lightCount = 256;
+    u32         materialCount = 4;
+    u32         frameCount = 600;
+    u32         warmupFrames = BENCHMARK_WARMUP_FRAMES;
+    f32         deltaTime = 1.0f / 60.0f;
+    u32         seed = 1;
+    Mode        mode = Mode::TexturedMesh;
+    Submission  submission = Submission::Instanced;
+    const char* outputPath = BENCHMARK_DEFAULT_OUTPUT;
+};
+
+struct SceneBenchmark
+{
+    BenchmarkConfig config;
+
+    // Camera path
+    vec3 sceneCenter;
+    f32  sceneRadius;
+
+    // One sample per measured frame (the GPU ones only for the frames read back)
+    std::vector<f32> cpuFrameMs;
+    std::vector<f32> gpuFrameMs;
+    std::vector<f32> drawCalls;
+    std::vector<f32> stateBinds;
+    std::vector<f32> uploadedBytes;
+
+    u64 lastUploadedBytes;
+    u32 lastGpuResultsFrame;
+    u32 firstMeasuredGpuFrame;
+    u32 frameIdx;
+};
+
+// Parses a Mode or Submission name as used on the command line, returns false if unknown
+bool ParseBenchmarkMode(const char* name, Mode& mode);
+bool ParseBenchmarkSubmission(const char* name, Submission& submission);
+
+/**
+ * Replaces the entities and lights of app with the synthetic scene described by
+ * config, and waits for every texture to be resident. Call it after Init(). It
+ * returns false if the submission method can't draw that many entities per frame.
+ */
+bool InitSceneBenchmark(App* app, SceneBenchmark& benchmark, const BenchmarkConfig& config);
+
+// Places the camera for the next frame and sets the fixed time step
+void BeginBenchmarkFrame(App* app, SceneBenchmark& benchmark);
+
+// Records the stats of the frame just rendered, cpuFrameNs being its wall time
+void EndBenchmarkFrame(App* app, SceneBenchmark& benchmark, u64 cpuFrameNs);
+
+u32 GetBenchmarkFrameCount(const SceneBenchmark& benchmark);
+
+bool WriteBenchmarkResults(App* app, const SceneBenchmark& benchmark);
@@ -42,6 +42,89 @@ void UnmapBuffer(Buffer& buffer)
     glBindBuffer(buffer.type, 0);
 }
 
+Buffer CreatePersistentBuffer(u32 size, GLenum type, u32 regionCount)
+{
+    ASSERT(regionCount > 0 && regionCount <= MAX_BUFFER_REGIONS, "Invalid number of buffer regions");
+
+    Buffer buffer = {};
+    buffer.type = type;
+    buffer.regionCount = regionCount;
+    buffer.regionSize = (size / regionCount) & ~255u; // Keep every region start aligned for glBindBufferRange
+    buffer.size = buffer.regionSize * regionCount;
+    buffer.persistent = GLEXT_ARB_buffer_storage;
+
+    glGenBuffers(1, &buffer.handle);
+    glBindBuffer(type, buffer.handle);
+
+    if (buffer.persistent)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(type, buffer.size, NULL, flags);
+        buffer.data = glMapBufferRange(type, 0, buffer.size, flags);
+    }
+    else
+    {
+        glBufferData(type, buffer.size, NULL, GL_STREAM_DRAW);
+    }
+
+    glBindBuffer(type, 0);
+
+    return buffer;
+}
+
+void MapBufferRegion(Buffer& buffer)
+{
+    ASSERT(buffer.regionCount > 0, "The buffer was not created with CreatePersistentBuffer");
+
+    // Wait until the GPU has finished reading the region we are about to overwrite
+    GLsync& fence = buffer.fences[buffer.regionIdx];
+    if (fence)
+    {
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            buffer.stallCount++;
+            do
+            {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            } while (result == GL_TIMEOUT_EXPIRED);
+        }
+
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    if (!buffer.persistent)
+    {
+        glBindBuffer(buffer.type, buffer.handle);
+        buffer.data = glMapBufferRange(buffer.type, 0, buffer.size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+
+    buffer.head = buffer.regionIdx * buffer.regionSize;
+    buffer.regionEnd = buffer.head + buffer.regionSize;
+}
+
+void UnmapBufferRegion(Buffer& buffer)
+{
+    if (!buffer.persistent)
+    {
+        UnmapBuffer(buffer);
+        buffer.data = NULL;
+    }
+}
+
+void FenceBufferRegion(Buffer& buffer)
+{
+    ASSERT(buffer.regionCount > 0, "The buffer was not created with CreatePersistentBuffer");
+
+    GLsync& fence = buffer.fences[buffer.regionIdx];
+    if (fence)
+        glDeleteSync(fence);
+
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    buffer.regionIdx = (buffer.regionIdx + 1) % buffer.regionCount;
+}
+
 void AlignHead(Buffer& buffer, u32 alignment)
 {
     ASSERT(IsPowerOf2(alignment), "The alignment must be a power of 2");
@@ -52,6 +135,26 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
 {
     ASSERT(buffer.data != NULL, "The buffer must be mapped first");
     AlignHead(buffer, alignment);
+    ASSERT(buffer.regionEnd == 0 || buffer.head + size <= buffer.regionEnd, "Overflow of the current buffer region");
     memcpy((u8*)buffer.data + buffer.head, data, size);
     buffer.head += size;
+    buffer.bytesWritten += size;
+}
+
+u32 GetRemainingRegionSize(const Buffer& buffer, u32 alignment)
+{
+    ASSERT(buffer.regionCount > 0, "The buffer was not created with CreatePersistentBuffer");
+    const u32 head = Align(buffer.head, alignment);
+    return head < buffer.regionEnd ? buffer.regionEnd - head : 0;
+}
+
+void* ReserveAlignedData(Buffer& buffer, u32 size, u32 alignment)
+{
+    ASSERT(buffer.data != NULL, "The buffer must be mapped first");
+    AlignHead(buffer, alignment);
+    ASSERT(buffer.regionEnd == 0 || buffer.head + size <= buffer.regionEnd, "Overflow of the current buffer region");
+    void* ptr = (u8*)buffer.data + buffer.head;
+    buffer.head += size;
+    buffer.bytesWritten += size;
+    return ptr;
 }
\ No newline at end of file
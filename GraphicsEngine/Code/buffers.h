@@ -9,6 +9,7 @@ u32 Align(u32 value, u32 alignment);
 Buffer CreateBuffer(u32 size, GLenum type, GLenum usage);
 
 #define CreateConstantBuffer(size) CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
+#define CreateStorageBuffer(size) CreateBuffer(size, GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW)
 #define CreateStaticVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
 
@@ -18,10 +19,33 @@ void MapBuffer(Buffer& buffer, GLenum access);
 
 void UnmapBuffer(Buffer& buffer);
 
+/**
+ * Creates a buffer of size bytes split into regionCount regions that stays mapped for its whole
+ * lifetime. Each frame writes into its own region, and a fence keeps the CPU from
+ * overwriting a region the GPU may still be reading. If the driver lacks buffer
+ * storage, the regions are mapped unsynchronized every frame instead.
+ */
+Buffer CreatePersistentBuffer(u32 size, GLenum type, u32 regionCount);
+
+void MapBufferRegion(Buffer& buffer);
+
+void UnmapBufferRegion(Buffer& buffer);
+
+void FenceBufferRegion(Buffer& buffer);
+
 void AlignHead(Buffer& buffer, u32 alignment);
 
 void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
+/**
+ * Advances the head over size bytes and returns where they start in the mapped data,
+ * so the caller can write them in place.
+ */
+void* ReserveAlignedData(Buffer& buffer, u32 size, u32 alignment);
+
+// Bytes that still fit in the current region once the head is aligned
+u32 GetRemainingRegionSize(const Buffer& buffer, u32 alignment);
+
 #define PushData(buffer, data, size) PushAlignedData(buffer, data, size, 1)
 #define PushUInt(buffer, value) { u32 v = value; PushAlignedData(buffer, &v, sizeof(v), 4); }
 #define PushVec3(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
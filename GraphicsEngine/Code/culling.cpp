@@ -0,0 +1,170 @@
+#include "culling.h"
+#include "jobs.h"
+#include "profiler.h"
+
+#include <float.h>
+#include <algorithm>
+
+#define CULLING_BATCH_SIZE 1024
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    // Gribb-Hartmann: the planes are sums/differences of the rows of the matrix
+    const glm::mat4 m = glm::transpose(viewProjection);
+
+    Frustum frustum = {};
+    frustum.planes[0] = m[3] + m[0]; // left
+    frustum.planes[1] = m[3] - m[0]; // right
+    frustum.planes[2] = m[3] + m[1]; // bottom
+    frustum.planes[3] = m[3] - m[1]; // top
+    frustum.planes[4] = m[3] + m[2]; // near
+    frustum.planes[5] = m[3] - m[2]; // far
+
+    for (u32 i = 0; i < 6; ++i)
+        frustum.planes[i] /= glm::length(vec3(frustum.planes[i]));
+
+    return frustum;
+}
+
+bool SphereInFrustum(const Frustum& frustum, vec3 center, f32 radius)
+{
+    for (u32 i = 0; i < 6; ++i)
+    {
+        if (glm::dot(vec3(frustum.planes[i]), center) + frustum.planes[i].w < -radius)
+            return false;
+    }
+
+    return true;
+}
+
+bool AabbInFrustum(const Frustum& frustum, vec3 aabbMin, vec3 aabbMax)
+{
+    for (u32 i = 0; i < 6; ++i)
+    {
+        // Test the corner furthest along the plane normal
+        const vec3 normal = vec3(frustum.planes[i]);
+        const vec3 positiveVertex = glm::mix(aabbMin, aabbMax, glm::greaterThanEqual(normal, vec3(0.0f)));
+
+        if (glm::dot(normal, positiveVertex) + frustum.planes[i].w < 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+BoundingVolume ComputeBoundingVolume(const float* vertices, u32 vertexCount, u32 strideInFloats)
+{
+    BoundingVolume bounds = {};
+    if (vertexCount == 0)
+        return bounds;
+
+    bounds.aabbMin = vec3(FLT_MAX);
+    bounds.aabbMax = vec3(-FLT_MAX);
+
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const vec3 position = glm::make_vec3(vertices + i * strideInFloats);
+        bounds.aabbMin = glm::min(bounds.aabbMin, position);
+        bounds.aabbMax = glm::max(bounds.aabbMax, position);
+    }
+
+    // Center the sphere in the box, but only make it as big as the furthest vertex
+    bounds.sphereCenter = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const vec3 position = glm::make_vec3(vertices + i * strideInFloats);
+        bounds.sphereRadius = glm::max(bounds.sphereRadius, glm::distance(bounds.sphereCenter, position));
+    }
+
+    return bounds;
+}
+
+BoundingVolume MergeBoundingVolumes(const BoundingVolume& a, const BoundingVolume& b)
+{
+    BoundingVolume bounds = {};
+    bounds.aabbMin = glm::min(a.aabbMin, b.aabbMin);
+    bounds.aabbMax = glm::max(a.aabbMax, b.aabbMax);
+    bounds.sphereCenter = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+    bounds.sphereRadius = glm::max(glm::distance(bounds.sphereCenter, a.sphereCenter) + a.sphereRadius,
+                                   glm::distance(bounds.sphereCenter, b.sphereCenter) + b.sphereRadius);
+    return bounds;
+}
+
+void CullEntities(App* app)
+{
+    PROFILE_SCOPE("CullEntities");
+
+    app->visibleEntities.clear();
+
+    if (!app->enableFrustumCulling)
+    {
+        for (u32 i = 0; i < app->entities.size(); ++i)
+            app->visibleEntities.push_back(i);
+        return;
+    }
+
+    const Frustum frustum = ExtractFrustum(app->projectionMatrix * app->viewMatrix);
+
+    // Entities are tested in parallel, and compacted afterwards so the visible list keeps its order
+    std::vector<u8> visible(app->entities.size());
+
+    ParallelFor(app->entities.size(), CULLING_BATCH_SIZE, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i)
+        {
+            const Entity& entity = app->entities[i];
+            const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+            const BoundingVolume& bounds = mesh.bounds;
+            const glm::mat4& world = app->worldMatrices[i];
+
+            // Cheap sphere test first, scaled by the largest axis of the world matrix
+            const vec3 center = vec3(world * vec4(bounds.sphereCenter, 1.0f));
+            const f32 scale = glm::sqrt(glm::max(glm::max(glm::dot(world[0], world[0]), glm::dot(world[1], world[1])), glm::dot(world[2], world[2])));
+
+            if (!SphereInFrustum(frustum, center, bounds.sphereRadius * scale))
+            {
+                visible[i] = 0;
+                continue;
+            }
+
+            // World space box enclosing the transformed local box
+            const vec3 localCenter = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+            const vec3 localExtents = (bounds.aabbMax - bounds.aabbMin) * 0.5f;
+            const glm::mat3 absRotation = glm::mat3(glm::abs(vec3(world[0])), glm::abs(vec3(world[1])), glm::abs(vec3(world[2])));
+            const vec3 worldCenter = vec3(world * vec4(localCenter, 1.0f));
+            const vec3 worldExtents = absRotation * localExtents;
+
+            visible[i] = AabbInFrustum(frustum, worldCenter - worldExtents, worldCenter + worldExtents);
+        }
+    });
+
+    for (u32 i = 0; i < visible.size(); ++i)
+        if (visible[i])
+            app->visibleEntities.push_back(i);
+}
+
+f32 EntityViewDepth(const App* app, u32 entityIdx)
+{
+    const Mesh& mesh = app->meshes[app->models[app->entities[entityIdx].modelIndex].meshIdx];
+    const vec4 viewCenter = app->viewMatrix * (app->worldMatrices[entityIdx] * vec4(mesh.bounds.sphereCenter, 1.0f));
+    return -viewCenter.z;
+}
+
+void SortEntitiesFrontToBack(App* app)
+{
+    PROFILE_SCOPE("SortEntitiesFrontToBack");
+
+    // Sort by the view depth of the bounding sphere centers, nearest first
+    std::vector<std::pair<f32, u32>> keys(app->visibleEntities.size());
+
+    for (u32 i = 0; i < app->visibleEntities.size(); ++i)
+    {
+        const u32 entityIdx = app->visibleEntities[i];
+        keys[i] = std::make_pair(EntityViewDepth(app, entityIdx), entityIdx);
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    for (u32 i = 0; i < keys.size(); ++i)
+        app->visibleEntities[i] = keys[i].second;
+}
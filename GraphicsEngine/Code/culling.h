@@ -0,0 +1,37 @@
+#pragma once
+
+#include "engine.h"
+
+struct Frustum
+{
+    vec4 planes[6]; // xyz = inward normal, w = distance
+};
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+bool SphereInFrustum(const Frustum& frustum, vec3 center, f32 radius);
+
+bool AabbInFrustum(const Frustum& frustum, vec3 aabbMin, vec3 aabbMax);
+
+/**
+ * Computes the bounds of a set of interleaved vertices whose position is the
+ * first 3 floats of every vertex.
+ */
+BoundingVolume ComputeBoundingVolume(const float* vertices, u32 vertexCount, u32 strideInFloats);
+
+BoundingVolume MergeBoundingVolumes(const BoundingVolume& a, const BoundingVolume& b);
+
+/**
+ * Fills app->visibleEntities with the indices of the entities whose world space
+ * bounds intersect the view frustum of the current camera.
+ */
+void CullEntities(App* app);
+
+// Distance along the view direction from the camera to the center of the entity bounds
+f32 EntityViewDepth(const App* app, u32 entityIdx);
+
+/**
+ * Orders app->visibleEntities by distance to the camera, nearest first, so the
+ * occluders reach the depth buffer before the geometry they hide.
+ */
+void SortEntitiesFrontToBack(App* app);
@@ -7,12 +7,54 @@
 
 #include "assimp.h"
 #include "buffers.h"
+#include "culling.h"
+#include "filewatcher.h"
+#include "glstate.h"
+#include "gputimers.h"
+#include "jobs.h"
+#include "lighting.h"
+#include "lod.h"
+#include "profiler.h"
+#include "programcache.h"
+#include "renderqueue.h"
+#include "vertexcompression.h"
 
 #include <imgui.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
 
-GLuint CreateProgramFromSource(App* app, String programSource, const char* shaderName)
+#include <algorithm>
+
+// Number of frames whose uniforms can be in flight at the same time
+#define BUFFER_REGION_COUNT 3
+
+// Size of each frame region of the instance buffer, and how many instances fit in it
+#define INSTANCE_REGION_SIZE MB(8)
+#define INSTANCE_PARAMS_SIZE (2 * sizeof(glm::mat4))
+#define MAX_INSTANCES (INSTANCE_REGION_SIZE / INSTANCE_PARAMS_SIZE)
+
+// Space kept for the global parameters at the start of each frame region of the uniform buffer
+#define GLOBAL_PARAMS_RESERVED_SIZE 256
+
+// Vertex attribute location of the per-instance index used by multi-draw-indirect
+#define INSTANCE_ID_LOCATION 5
+
+// Vertex buffer binding points of the cached vaos
+#define VERTEX_BINDING      0
+#define INSTANCE_ID_BINDING 1
+
+#define ARENA_MIN_VERTEX_CAPACITY 65536u
+#define ARENA_MIN_INDEX_CAPACITY  (3u * 65536u)
+
+// Explicit uniform locations of the deferred shading programs
+#define SMOOTHNESS_LOCATION   0
+#define SPECULAR_LOCATION     1
+#define GBUFFER_VIEW_LOCATION 0
+
+// Number of entities transformed by each job
+#define TRANSFORM_BATCH_SIZE 1024
+
+GLuint CreateProgramFromSource(App* app, String programSource, const char* shaderName, const char* defines)
 {
     GLchar  infoLogBuffer[1024] = {};
     GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
@@ -28,24 +70,28 @@ GLuint CreateProgramFromSource(App* app, String programSource, const char* shade
     const GLchar* vertexShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         vertexShaderDefine,
         programSource.str
     };
     const GLint vertexShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(vertexShaderDefine),
         (GLint) programSource.len
     };
     const GLchar* fragmentShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         fragmentShaderDefine,
         programSource.str
     };
     const GLint fragmentShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(fragmentShaderDefine),
         (GLint) programSource.len
     };
@@ -77,6 +123,7 @@ GLuint CreateProgramFromSource(App* app, String programSource, const char* shade
     GLuint programHandle = glCreateProgram();
     glAttachShader(programHandle, vshader);
     glAttachShader(programHandle, fshader);
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(programHandle);
     glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
     if (!success)
@@ -95,17 +142,41 @@ GLuint CreateProgramFromSource(App* app, String programSource, const char* shade
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+GLuint CreateProgram(App* app, const Program& program, String programSource)
 {
-    String programSource = ReadTextFile(filepath);
+    const u64 startTimestamp = GetTimestampNs();
+    const char* programName = program.programName.c_str();
+    const char* defines = program.defines.c_str();
 
-    Program program = {};
-    program.handle = CreateProgramFromSource(app, programSource, programName);
-    program.filepath = filepath;
-    program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    u64 key = MakeProgramCacheKey(programSource, programName, defines);
+
+    // Variants of the same program with different defines get their own cache file
+    char cacheExtension[256];
+    sprintf(cacheExtension, ".%s.%08x.program", programName, (u32)HashBytes(defines, program.defines.size()));
+    String cachePath = MakeCachePath(program.filepath.c_str(), cacheExtension);
+
+    GLuint programHandle = LoadProgramBinary(cachePath.str, key);
+    if (programHandle)
+    {
+        app->programCacheHits++;
+        ILOG("Program %s loaded from the binary cache in %.2f ms (%u hits, %u misses)", programName,
+             (GetTimestampNs() - startTimestamp) / 1000000.0, app->programCacheHits, app->programCacheMisses);
+        return programHandle;
+    }
+
+    app->programCacheMisses++;
+    programHandle = CreateProgramFromSource(app, programSource, programName, defines);
+    SaveProgramBinary(cachePath.str, key, programHandle);
+
+    ILOG("Program %s compiled in %.2f ms (%u hits, %u misses)", programName,
+         (GetTimestampNs() - startTimestamp) / 1000000.0, app->programCacheHits, app->programCacheMisses);
+    return programHandle;
+}
+
+void ReadVertexInputLayout(Program& program)
+{
+    program.vertexInputLayout.attributes.clear();
 
-    // Fill input vertex shader
     GLint attributeCount;
     glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
 
@@ -124,6 +195,26 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
         program.vertexInputLayout.attributes.push_back({ attributeLocation, (u8)attributeSize });
     }
 
+    // Keep the attributes sorted so equal layouts share the same vao
+    std::sort(program.vertexInputLayout.attributes.begin(), program.vertexInputLayout.attributes.end(),
+        [](const VertexShaderAttribute& a, const VertexShaderAttribute& b) { return a.location < b.location; });
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, const char* defines = "")
+{
+    PROFILE_SCOPE("LoadProgram");
+
+    Program program = {};
+    program.filepath = filepath;
+    program.programName = programName;
+    program.defines = defines;
+    program.handle = CreateProgram(app, program, ReadTextFile(filepath));
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+
+    WatchFile(filepath);
+
+    ReadVertexInputLayout(program);
+
     app->programs.push_back(program);
     return app->programs.size() - 1;
 }
@@ -131,7 +222,8 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
 Image LoadImage(const char* filename)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
+    // Images can be decoded from job threads, so the flag is set per thread
+    stbi_set_flip_vertically_on_load_thread(true);
     img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
     if (img.pixels)
     {
@@ -149,7 +241,7 @@ void FreeImage(Image image)
     stbi_image_free(image.pixels);
 }
 
-GLuint CreateTexture2DFromImage(Image image)
+GLuint CreateTexture2DFromImage(Image image, GLuint stagingBuffer = 0)
 {
     GLenum internalFormat = GL_RGB8;
     GLenum dataFormat     = GL_RGB;
@@ -162,10 +254,23 @@ GLuint CreateTexture2DFromImage(Image image)
         default: ELOG("LoadTexture2D() - Unsupported number of channels");
     }
 
+    // With a pixel unpack buffer the copy to the texture is done by the driver asynchronously
+    const void* pixels = image.pixels;
+    if (stagingBuffer)
+    {
+        u32 size = image.stride * image.size.y;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW); // Orphan the storage of the previous upload
+        void* stagingData = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        memcpy(stagingData, image.pixels, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        pixels = NULL; // Offset into the unpack buffer
+    }
+
     GLuint texHandle;
     glGenTextures(1, &texHandle);
     glBindTexture(GL_TEXTURE_2D, texHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -174,68 +279,382 @@ GLuint CreateTexture2DFromImage(Image image)
     glGenerateMipmap(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, 0);
 
+    if (stagingBuffer)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
     return texHandle;
 }
 
 u32 LoadTexture2D(App* app, const char* filepath)
 {
+    PROFILE_SCOPE("LoadTexture2D");
+
     for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
         if (app->textures[texIdx].filepath == filepath)
             return texIdx;
 
-    Image image = LoadImage(filepath);
+    // The placeholders are loaded synchronously by Init(), before any other texture
+    Texture tex = {};
+    tex.handle = app->textures[app->whiteTexIdx].handle;
+    tex.filepath = filepath;
+    tex.state = TextureState_Loading;
+
+    u32 texIdx = app->textures.size();
+    app->textures.push_back(tex);
+
+    TextureLoad* load = new TextureLoad;
+    load->textureIdx = texIdx;
+    load->filepath = filepath;
+    load->image = {};
+    load->decoded = false;
+    load->cancelled = false;
+    app->textureLoads.push_back(load);
+
+    RunJob([load]() {
+        PROFILE_SCOPE("DecodeTexture");
+        if (!load->cancelled)
+            load->image = LoadImage(load->filepath.c_str());
+        load->decoded = true;
+    }, &app->textureDecodeCounter);
+
+    return texIdx;
+}
+
+void UpdateTextureLoads(App* app)
+{
+    PROFILE_SCOPE("UpdateTextureLoads");
+
+    const u64 startTimestamp = GetTimestampNs();
+    const u64 budgetNs = (u64)(app->textureUploadBudgetMs * 1000000.0f);
+    u32 uploadCount = 0;
 
-    if (image.pixels)
+    for (u32 i = 0; i < app->textureLoads.size(); )
     {
-        Texture tex = {};
-        tex.handle = CreateTexture2DFromImage(image);
-        tex.filepath = filepath;
+        TextureLoad* load = app->textureLoads[i];
+        if (!load->decoded)
+        {
+            ++i;
+            continue;
+        }
 
-        u32 texIdx = app->textures.size();
-        app->textures.push_back(tex);
+        // At least one upload per frame, so a texture bigger than the budget still gets through
+        if (uploadCount > 0 && GetTimestampNs() - startTimestamp > budgetNs)
+            break;
 
-        FreeImage(image);
-        return texIdx;
+        Texture& tex = app->textures[load->textureIdx];
+        if (load->image.pixels)
+        {
+            tex.handle = CreateTexture2DFromImage(load->image, app->textureStagingBuffer);
+            tex.state = TextureState_Resident;
+            app->textureBytesUploaded += load->image.stride * load->image.size.y;
+            FreeImage(load->image);
+        }
+        else
+        {
+            tex.handle = app->textures[app->magentaTexIdx].handle;
+            tex.state = TextureState_Failed;
+        }
+
+        uploadCount++;
+        delete load;
+        app->textureLoads[i] = app->textureLoads.back();
+        app->textureLoads.pop_back();
     }
-    else
+}
+
+void CancelTextureLoads(App* app)
+{
+    for (u32 i = 0; i < app->textureLoads.size(); ++i)
+        app->textureLoads[i]->cancelled = true;
+
+    // The queued decodes run here and return at once, the ones already running finish their image
+    WaitForCounter(&app->textureDecodeCounter);
+
+    for (u32 i = 0; i < app->textureLoads.size(); ++i)
+    {
+        TextureLoad* load = app->textureLoads[i];
+        if (load->image.pixels)
+            FreeImage(load->image);
+        delete load;
+    }
+    app->textureLoads.clear();
+}
+
+void LoadTextures2D(App* app, const char** filepaths, u32 count, u32* textureIndices)
+{
+    // Decoding runs in parallel, while the uploads stay on the thread that owns the context
+    std::vector<Image> images(count);
+
+    ParallelFor(count, 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i)
+            images[i] = LoadImage(filepaths[i]);
+    });
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        textureIndices[i] = UINT32_MAX;
+
+        for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+            if (app->textures[texIdx].filepath == filepaths[i])
+                textureIndices[i] = texIdx;
+
+        if (images[i].pixels && textureIndices[i] == UINT32_MAX)
+        {
+            Texture tex = {};
+            tex.handle = CreateTexture2DFromImage(images[i]);
+            tex.filepath = filepaths[i];
+            tex.state = TextureState_Resident;
+
+            textureIndices[i] = app->textures.size();
+            app->textures.push_back(tex);
+        }
+
+        if (images[i].pixels)
+            FreeImage(images[i]);
+    }
+}
+
+bool SameVertexBufferLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
+{
+    if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+        return false;
+
+    for (u32 i = 0; i < a.attributes.size(); ++i)
+    {
+        if (a.attributes[i].location != b.attributes[i].location ||
+            a.attributes[i].componentCount != b.attributes[i].componentCount ||
+            a.attributes[i].offset != b.attributes[i].offset ||
+            a.attributes[i].type != b.attributes[i].type ||
+            a.attributes[i].normalized != b.attributes[i].normalized)
+            return false;
+    }
+
+    return true;
+}
+
+void ResizeArenaBuffer(GLuint& bufferHandle, u32 usedSize, u32 newSize)
+{
+    GLuint newBufferHandle;
+    glGenBuffers(1, &newBufferHandle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferHandle);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+
+    if (bufferHandle)
+    {
+        // Keep the geometry already stored in the arena
+        glBindBuffer(GL_COPY_READ_BUFFER, bufferHandle);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedSize);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, &bufferHandle);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    bufferHandle = newBufferHandle;
+}
+
+GLenum ChooseIndexType(u32 vertexCount)
+{
+    // Draws add baseVertex, so the indices only have to address the vertices of their own submesh.
+    // 0xFFFF is left unused, it's the primitive restart index of 16-bit indices
+    return vertexCount <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+u32 GetIndexTypeSize(GLenum indexType)
+{
+    switch (indexType)
     {
-        return UINT32_MAX;
+        case GL_UNSIGNED_BYTE:  return 1;
+        case GL_UNSIGNED_SHORT: return 2;
+        default:                return 4;
     }
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+void AddSubmeshToArena(App* app, Submesh& submesh)
 {
-    Submesh& submesh = mesh.submeshes[submeshIndex];
+    if (submesh.indexType == 0)
+        submesh.indexType = GL_UNSIGNED_INT;
 
-    // Try finding a vao for this submesh/program
-    for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
+    // Find the arena that stores this vertex layout and index type
+    u32 arenaIdx = 0;
+    while (arenaIdx < app->arenas.size() && (app->arenas[arenaIdx].indexType != submesh.indexType ||
+           !SameVertexBufferLayout(app->arenas[arenaIdx].vertexBufferLayout, submesh.vertexBufferLayout)))
+        arenaIdx++;
+
+    if (arenaIdx == app->arenas.size())
     {
-        if (submesh.vaos[i].programHandle == program.handle)
-            return submesh.vaos[i].handle;
+        GeometryArena arena = {};
+        arena.vertexBufferLayout = submesh.vertexBufferLayout;
+        arena.indexType = submesh.indexType;
+
+        // The depth pre-pass reads the positions from their own stream, so it fetches only the bytes it uses.
+        // They keep the format of the interleaved ones, so both passes decode the same values into the same depth
+        const VertexBufferAttribute* positionAttribute = NULL;
+        for (u32 i = 0; i < arena.vertexBufferLayout.attributes.size(); ++i)
+            if (arena.vertexBufferLayout.attributes[i].location == 0)
+                positionAttribute = &arena.vertexBufferLayout.attributes[i];
+
+        ASSERT(positionAttribute != NULL, "Submeshes must have positions at location 0");
+
+        VertexBufferAttribute position = *positionAttribute;
+        position.offset = 0;
+        arena.positionLayout.attributes.push_back(position);
+        arena.positionLayout.stride = Align(GetVertexAttributeSize(position), 4);
+
+        app->arenas.push_back(arena);
     }
 
-    // Create a new vao for 
+    GeometryArena& arena = app->arenas[arenaIdx];
+    const u32 stride = arena.vertexBufferLayout.stride;
+    const u32 positionStride = arena.positionLayout.stride;
+    const u32 indexSize = GetIndexTypeSize(arena.indexType);
+    const u32 vertexCount = submesh.vertices.size() * sizeof(float) / stride;
+    const u32 indexCount = submesh.indices.size();
+
+    // Grow the arena buffers geometrically when they run out of space
+
+    if (arena.vertexCount + vertexCount > arena.vertexCapacity)
+    {
+        u32 newCapacity = glm::max(glm::max(arena.vertexCapacity * 2, arena.vertexCount + vertexCount), ARENA_MIN_VERTEX_CAPACITY);
+        ResizeArenaBuffer(arena.vertexBufferHandle, arena.vertexCount * stride, newCapacity * stride);
+        ResizeArenaBuffer(arena.positionBufferHandle, arena.vertexCount * positionStride, newCapacity * positionStride);
+        arena.vertexCapacity = newCapacity;
+    }
+
+    if (arena.indexCount + indexCount > arena.indexCapacity)
+    {
+        u32 newCapacity = glm::max(glm::max(arena.indexCapacity * 2, arena.indexCount + indexCount), ARENA_MIN_INDEX_CAPACITY);
+        ResizeArenaBuffer(arena.indexBufferHandle, arena.indexCount * indexSize, newCapacity * indexSize);
+        arena.indexCapacity = newCapacity;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, arena.vertexBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, arena.vertexCount * stride, vertexCount * stride, submesh.vertices.data());
+
+    // Copied byte for byte from the interleaved vertices
+    const VertexBufferAttribute& position = arena.positionLayout.attributes[0];
+    const u32 positionSize = GetVertexAttributeSize(position);
+    u32 positionOffset = 0;
+    for (u32 i = 0; i < arena.vertexBufferLayout.attributes.size(); ++i)
+        if (arena.vertexBufferLayout.attributes[i].location == 0)
+            positionOffset = arena.vertexBufferLayout.attributes[i].offset;
+
+    std::vector<u8> positions((u64)vertexCount * positionStride, 0);
+    const u8* vertexData = (const u8*)submesh.vertices.data();
+    for (u32 i = 0; i < vertexCount; ++i)
+        memcpy(&positions[(u64)i * positionStride], vertexData + (u64)i * stride + positionOffset, positionSize);
+
+    glBindBuffer(GL_ARRAY_BUFFER, arena.positionBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, arena.vertexCount * positionStride, vertexCount * positionStride, positions.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Indices are processed as u32 and narrowed on upload
+    std::vector<u16> shortIndices;
+    const void* indexData = submesh.indices.data();
+    if (arena.indexType == GL_UNSIGNED_SHORT)
+    {
+        ASSERT(vertexCount <= 0xFFFF, "Too many vertices for 16-bit indices");
+        shortIndices.assign(submesh.indices.begin(), submesh.indices.end());
+        indexData = shortIndices.data();
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena.indexBufferHandle);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, arena.indexCount * indexSize, indexCount * indexSize, indexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    submesh.arenaIdx = arenaIdx;
+    submesh.baseVertex = arena.vertexCount;
+    submesh.firstIndex = arena.indexCount;
+    submesh.vertexCount = vertexCount;
+    submesh.indexCount = indexCount;
+
+    // Submeshes without generated levels of detail are always drawn whole
+    if (submesh.lods.empty())
+        submesh.lods.push_back(SubmeshLod{ 0, indexCount });
+
+    arena.vertexCount += vertexCount;
+    arena.indexCount += indexCount;
+}
+
+void ReleaseMeshCpuData(Mesh& mesh)
+{
+    // Swapping with empty vectors frees the storage, clear() would keep the capacity
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        Submesh& submesh = mesh.submeshes[i];
+        ASSERT(submesh.vertexCount == submesh.vertices.size() * sizeof(float) / submesh.vertexBufferLayout.stride, "The submesh must be uploaded first");
+        std::vector<float>().swap(submesh.vertices);
+        std::vector<u32>().swap(submesh.indices);
+    }
+}
+
+u64 HashVaoLayout(const VertexBufferLayout& bufferLayout, const VertexShaderLayout& shaderLayout)
+{
+    // FNV-1a
+    u64 hash = 14695981039346656037ull;
+    auto hashByte = [&hash](u8 byte) { hash = (hash ^ byte) * 1099511628211ull; };
+
+    hashByte(bufferLayout.stride);
+    for (u32 i = 0; i < bufferLayout.attributes.size(); ++i)
+    {
+        hashByte(bufferLayout.attributes[i].location);
+        hashByte(bufferLayout.attributes[i].componentCount);
+        hashByte(bufferLayout.attributes[i].offset);
+        hashByte((u8)bufferLayout.attributes[i].type);
+        hashByte((u8)(bufferLayout.attributes[i].type >> 8));
+        hashByte(bufferLayout.attributes[i].normalized);
+    }
+
+    hashByte(0xff); // separator
+    for (u32 i = 0; i < shaderLayout.attributes.size(); ++i)
+    {
+        hashByte(shaderLayout.attributes[i].location);
+        hashByte(shaderLayout.attributes[i].componentCount);
+    }
+
+    return hash;
+}
+
+GLuint FindVAO(App* app, const VertexBufferLayout& bufferLayout, const Program& program)
+{
+    // Try finding a vao for this pair of layouts
+    u64 key = HashVaoLayout(bufferLayout, program.vertexInputLayout);
+
+    auto it = app->vaoCache.find(key);
+    if (it != app->vaoCache.end())
+        return it->second;
+
+    // Create a new vao. It only stores the vertex format, buffers are bound at draw time
     GLuint vaoHandle = 0;
     glGenVertexArrays(1, &vaoHandle);
     glBindVertexArray(vaoHandle);
 
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-
     // We have to link all vertex inputs attributes to attributes in the vertex buffer
     for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
     {
         bool attributeWasLinked = false;
 
-        for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
+        // The instance index is not part of the geometry, it is fetched once per instance
+        if (program.vertexInputLayout.attributes[i].location == INSTANCE_ID_LOCATION)
+        {
+            glVertexAttribIFormat(INSTANCE_ID_LOCATION, 1, GL_UNSIGNED_INT, 0);
+            glVertexAttribBinding(INSTANCE_ID_LOCATION, INSTANCE_ID_BINDING);
+            glEnableVertexAttribArray(INSTANCE_ID_LOCATION);
+            glVertexBindingDivisor(INSTANCE_ID_BINDING, 1);
+            glBindVertexBuffer(INSTANCE_ID_BINDING, app->instanceIdBuffer, 0, sizeof(u32));
+            continue;
+        }
+
+        for (u32 j = 0; j < bufferLayout.attributes.size(); ++j)
         {
-            if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
+            if (program.vertexInputLayout.attributes[i].location == bufferLayout.attributes[j].location)
             {
-                const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-                const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-                const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset; // attribute offset + vertex offset
-                const u32 stride = submesh.vertexBufferLayout.stride;
-                glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
+                const u32 index = bufferLayout.attributes[j].location;
+                const u32 ncomp = bufferLayout.attributes[j].componentCount;
+                const u32 offset = bufferLayout.attributes[j].offset;
+                const GLenum type = bufferLayout.attributes[j].type;
+                const GLboolean normalized = bufferLayout.attributes[j].normalized;
+                glVertexAttribFormat(index, ncomp, type, normalized, offset);
+                glVertexAttribBinding(index, VERTEX_BINDING);
                 glEnableVertexAttribArray(index);
 
                 attributeWasLinked = true;
@@ -248,13 +667,32 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 
     glBindVertexArray(0);
 
-    // Store it in the list of vaos for this submesh
-    Vao vao = { vaoHandle, program.handle };
-    submesh.vaos.push_back(vao);
+    app->vaoCache[key] = vaoHandle;
 
     return vaoHandle;
 }
 
+void BindArenaVAO(App* app, u32 arenaIdx, const Program& program, bool positionsOnly = false)
+{
+    GeometryArena& arena = app->arenas[arenaIdx];
+
+    if (positionsOnly)
+    {
+        // Position stream: same vertex indices as the interleaved buffer, so baseVertex still applies
+        GLuint vao = FindVAO(app, arena.positionLayout, program);
+        CachedBindVertexArray(app->glState, vao);
+        CachedBindVertexBuffer(app->glState, VERTEX_BINDING, arena.positionBufferHandle, arena.positionLayout.stride);
+    }
+    else
+    {
+        GLuint vao = FindVAO(app, arena.vertexBufferLayout, program);
+        CachedBindVertexArray(app->glState, vao);
+        CachedBindVertexBuffer(app->glState, VERTEX_BINDING, arena.vertexBufferHandle, arena.vertexBufferLayout.stride);
+    }
+
+    CachedBindElementBuffer(app->glState, arena.indexBufferHandle);
+}
+
 void OnGLError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
 {
     if (severity == GL_DEBUG_SEVERITY_NOTIFICATION)
@@ -293,9 +731,35 @@ void OnGLError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei l
     }
 }
 
+u32 AddEntity(App* app, const glm::mat4& worldMatrix, u32 modelIndex)
+{
+    app->entities.push_back(Entity(modelIndex, 0, 0));
+    app->worldMatrices.push_back(worldMatrix);
+    return app->entities.size() - 1;
+}
+
+u32 GetMaxSubmittedEntities(const App* app, Submission submission)
+{
+    if (submission == Submission::PerEntity)
+    {
+        // One aligned block per entity, after the global parameters
+        const u32 stride = Align(INSTANCE_PARAMS_SIZE, app->uniformBufferAlignment);
+        const u32 globalParamsSize = Align(GLOBAL_PARAMS_RESERVED_SIZE, app->uniformBufferAlignment);
+        return (app->cbuffer.regionSize - globalParamsSize) / stride;
+    }
+
+    // Every instance group (one per model and level of detail) may lose an instance to alignment
+    const u32 paddingPerGroup = (app->storageBufferAlignment + INSTANCE_PARAMS_SIZE - 1) / INSTANCE_PARAMS_SIZE;
+    const u32 padding = app->models.size() * MAX_LODS * paddingPerGroup;
+    return padding < MAX_INSTANCES ? MAX_INSTANCES - padding : 0;
+}
+
 void Init(App* app)
 {
     app->mode = Mode::TexturedMesh;
+    app->cameraPosition = vec3(0.0f, 2.0f, 7.5f);
+    app->cameraTarget = vec3(0.0f, 1.0f, 0.0f);
+    app->transformKernel = GetBestTransformKernel();
 
     // Gather OpenGL information
     std::string aux;
@@ -341,7 +805,26 @@ void Init(App* app)
     // Uniform buffers
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBufferAlignment);
-    app->cbuffer = CreateConstantBuffer(app->maxUniformBufferSize);
+    // GL_MAX_UNIFORM_BLOCK_SIZE only limits a bound range, so every frame region gets that much
+    app->cbuffer = CreatePersistentBuffer(BUFFER_REGION_COUNT * app->maxUniformBufferSize, GL_UNIFORM_BUFFER, BUFFER_REGION_COUNT);
+    ASSERT(app->cbuffer.regionSize == ((u32)app->maxUniformBufferSize & ~255u), "Every frame region must hold a whole uniform block");
+
+    // Storage buffers
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &app->storageBufferAlignment);
+    app->instanceBuffer = CreatePersistentBuffer(BUFFER_REGION_COUNT * INSTANCE_REGION_SIZE, GL_SHADER_STORAGE_BUFFER, BUFFER_REGION_COUNT);
+    app->lightBuffer = CreatePersistentBuffer(BUFFER_REGION_COUNT * LIGHT_REGION_SIZE, GL_SHADER_STORAGE_BUFFER, BUFFER_REGION_COUNT);
+
+    // Indirect draw buffers
+    app->indirectBuffer = CreatePersistentBuffer(BUFFER_REGION_COUNT * KB(256), GL_DRAW_INDIRECT_BUFFER, BUFFER_REGION_COUNT);
+
+    std::vector<u32> instanceIds(MAX_INSTANCES);
+    for (u32 i = 0; i < MAX_INSTANCES; ++i)
+        instanceIds[i] = i;
+
+    glGenBuffers(1, &app->instanceIdBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, app->instanceIdBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instanceIds.size() * sizeof(u32), instanceIds.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     // Vertex buffers 
     glGenBuffers(1, &app->embeddedVertices);
@@ -368,30 +851,44 @@ void Init(App* app)
 
     // Programs
     app->texturedGeometryProgramIdx = LoadProgram(app, "shaders.glsl", "TEXTURED_GEOMETRY");
-    app->texturedMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH");
-
-    // Load textures
+    app->texturedMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH", VERTEX_COMPRESSION_DEFINES);
+    app->texturedMeshInstancedProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_INSTANCED", VERTEX_COMPRESSION_DEFINES);
+    app->texturedMeshIndirectProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_INDIRECT", VERTEX_COMPRESSION_DEFINES);
+    app->gbufferMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH", VERTEX_COMPRESSION_DEFINES "#define GBUFFER\n");
+    app->gbufferMeshInstancedProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_INSTANCED", VERTEX_COMPRESSION_DEFINES "#define GBUFFER\n");
+    app->gbufferMeshIndirectProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_INDIRECT", VERTEX_COMPRESSION_DEFINES "#define GBUFFER\n");
+    app->deferredLightingProgramIdx = LoadProgram(app, "shaders.glsl", "DEFERRED_LIGHTING");
+    app->depthMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH", "#define DEPTH_ONLY\n");
+    app->depthMeshInstancedProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_INSTANCED", "#define DEPTH_ONLY\n");
+    app->depthMeshIndirectProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_INDIRECT", "#define DEPTH_ONLY\n");
+
+    // Timer queries
+    InitGpuTimers();
+
+    // Pipeline statistics
+    if (GLEXT_ARB_pipeline_statistics_query)
+        glGenQueries(FRAGMENT_QUERY_COUNT, app->fragmentQueries);
+
+    // Load textures, the placeholders used while the rest are loading first
+    const char* texturePaths[] = { "color_white.png", "color_black.png", "color_normal.png", "color_magenta.png" };
+    u32 textureIndices[ARRAY_COUNT(texturePaths)];
+    LoadTextures2D(app, texturePaths, ARRAY_COUNT(texturePaths), textureIndices);
+
+    app->whiteTexIdx = textureIndices[0];
+    app->blackTexIdx = textureIndices[1];
+    app->normalTexIdx = textureIndices[2];
+    app->magentaTexIdx = textureIndices[3];
+
+    glGenBuffers(1, &app->textureStagingBuffer);
     app->diceTexIdx = LoadTexture2D(app, "dice.png");
-    app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
-    app->blackTexIdx = LoadTexture2D(app, "color_black.png");
-    app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
-    app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png");
 
     // Load models
     app->model = LoadModel(app, "Patrick/Patrick.obj");
 
     // Create entities
-    Entity ent1 = Entity(glm::mat4(1.0), app->model, 0, 0);
-    ent1.worldMatrix = glm::translate(ent1.worldMatrix, vec3(0.0, 1.0, -2.0));
-    app->entities.push_back(ent1);
-
-    Entity ent2 = Entity(glm::mat4(1.0), app->model, 0, 0);
-    ent2.worldMatrix = glm::translate(ent2.worldMatrix, vec3(5.0, 1.0, -5.0));
-    app->entities.push_back(ent2);
-
-    Entity ent3 = Entity(glm::mat4(1.0), app->model, 0, 0);
-    ent3.worldMatrix = glm::translate(ent3.worldMatrix, vec3(-5.0, 1.0, -5.0));
-    app->entities.push_back(ent3);
+    AddEntity(app, glm::translate(glm::mat4(1.0), vec3(0.0, 1.0, -2.0)), app->model);
+    AddEntity(app, glm::translate(glm::mat4(1.0), vec3(5.0, 1.0, -5.0)), app->model);
+    AddEntity(app, glm::translate(glm::mat4(1.0), vec3(-5.0, 1.0, -5.0)), app->model);
 
     // Create lights
     Light light1 = Light(LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(1.0, 1.0, 0.0), vec3(0.0, 10.0, 0.0));
@@ -404,165 +901,817 @@ void Init(App* app)
     app->lights.push_back(light3);
 }
 
+// Memory held by the CPU copies and the arena buffers of a mesh
+static u64 GetMeshCpuBytes(const Mesh& mesh)
+{
+    u64 bytes = 0;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        bytes += submesh.vertices.capacity() * sizeof(float) + submesh.indices.capacity() * sizeof(u32) + submesh.lods.capacity() * sizeof(SubmeshLod);
+    }
+    return bytes;
+}
+
+static u64 GetMeshGpuBytes(const App* app, const Mesh& mesh)
+{
+    u64 bytes = 0;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        const GeometryArena& arena = app->arenas[submesh.arenaIdx];
+        bytes += (u64)submesh.vertexCount * (arena.vertexBufferLayout.stride + arena.positionLayout.stride) + (u64)submesh.indexCount * GetIndexTypeSize(arena.indexType);
+    }
+    return bytes;
+}
+
 void Gui(App* app)
 {
     ImGui::Begin("Info");
     ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
+    ImGui::Text("Draw calls: %u", app->drawCalls);
+    ImGui::Text("State binds: %u issued, %u skipped", app->glState.bindsIssued, app->glState.bindsSkipped);
+    ImGui::Text("Vaos: %u", (u32)app->vaoCache.size());
+    for (u32 i = 0; i < app->arenas.size(); ++i)
+    {
+        const GeometryArena& arena = app->arenas[i];
+        ImGui::Text("Arena %u: %u vertices, %u bytes/vertex (%.2f MB)", i, arena.vertexCount, arena.vertexBufferLayout.stride,
+                    arena.vertexCount * arena.vertexBufferLayout.stride / (1024.0f * 1024.0f));
+        ImGui::Text("         %u indices, %u bits/index (%.2f MB)", arena.indexCount, GetIndexTypeSize(arena.indexType) * 8,
+                    arena.indexCount * GetIndexTypeSize(arena.indexType) / (1024.0f * 1024.0f));
+    }
+
+    u64 meshCpuBytes = 0;
+    u64 meshGpuBytes = 0;
+    for (u32 i = 0; i < app->meshes.size(); ++i)
+    {
+        meshCpuBytes += GetMeshCpuBytes(app->meshes[i]);
+        meshGpuBytes += GetMeshGpuBytes(app, app->meshes[i]);
+    }
+
+    if (ImGui::TreeNode("Meshes", "Mesh memory: %.2f MB CPU, %.2f MB GPU", meshCpuBytes / (1024.0f * 1024.0f), meshGpuBytes / (1024.0f * 1024.0f)))
+    {
+        for (u32 i = 0; i < app->meshes.size(); ++i)
+        {
+            const Mesh& mesh = app->meshes[i];
+            ImGui::Text("%s: %.2f MB CPU%s, %.2f MB GPU", mesh.name.c_str(), GetMeshCpuBytes(mesh) / (1024.0f * 1024.0f),
+                        mesh.keepCpuData ? " (kept)" : "", GetMeshGpuBytes(app, mesh) / (1024.0f * 1024.0f));
+        }
+        ImGui::TreePop();
+    }
+
+    u32 visibleCount = app->visibleEntities.size();
+    ImGui::Checkbox("Frustum culling", &app->enableFrustumCulling);
+
+    ImGui::Checkbox("Levels of detail", &app->enableLods);
+    ImGui::Text("Triangles: %u (%u at full detail)", app->triangleCount, app->fullDetailTriangleCount);
+    ImGui::Text("Entities per LOD: %u / %u / %u / %u / %u", app->lodEntityCounts[0], app->lodEntityCounts[1],
+                app->lodEntityCounts[2], app->lodEntityCounts[3], app->lodEntityCounts[4]);
+
+    const char* kernelNames[] = { "Scalar", "SSE", "AVX" };
+    ImGui::Combo("Transform kernel", (int*)&app->transformKernel, kernelNames, (int)GetBestTransformKernel() + 1);
+    if (ImGui::Button("Run transform benchmark"))
+        RunTransformBenchmark();
+    ImGui::Text("Program cache: %u hits, %u misses", app->programCacheHits, app->programCacheMisses);
+    ImGui::Text("Job threads: %u", GetJobThreadCount());
+    ImGui::Text("Textures: %u loading, %.2f MB uploaded", (u32)app->textureLoads.size(), app->textureBytesUploaded / (1024.0f * 1024.0f));
+    ImGui::SliderFloat("Texture upload budget (ms)", &app->textureUploadBudgetMs, 0.0f, 16.0f);
+    if (ImGui::Button("Run job system benchmark"))
+        RunJobSystemBenchmark();
+
+    const LightClusters& clusters = app->lightClusters;
+    ImGui::Checkbox("Clustered lighting", &app->enableClusteredLighting);
+    ImGui::Text("Lights: %u, %u cluster assignments, %u dropped", (u32)clusters.lights.size(), clusters.assignedLightCount, clusters.overflowCount);
+    if (ImGui::Button("Add 1000 point lights"))
+        AddRandomPointLights(app, 1000);
+    ImGui::Text("Entities: %u visible, %u culled", visibleCount, (u32)app->entities.size() - visibleCount);
+    if (app->droppedInstances > 0)
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Entities dropped: %u of the visible ones (%s full)", app->droppedInstances,
+                           app->submission == Submission::PerEntity ? "uniform buffer" : "instance buffer");
+
+    const char* modeNames[] = { "Textured quad", "Textured mesh", "Deferred" };
+    ImGui::Combo("Mode", (int*)&app->mode, modeNames, (int)Mode::Count);
+
+    if (app->mode == Mode::Deferred)
+    {
+        const char* gbufferViewNames[] = { "Lit", "Albedo", "Smoothness", "Normals", "Depth", "Position", "Specular" };
+        ImGui::Combo("G-buffer view", (int*)&app->gbufferView, gbufferViewNames, (int)GBufferView::Count);
+    }
+
+    const char* submissionNames[] = { "Per entity", "Instanced", "Multi-draw indirect" };
+    ImGui::Combo("Submission", (int*)&app->submission, submissionNames, (int)Submission::Count);
+
+    ImGui::Checkbox("Depth pre-pass", &app->enableDepthPrepass);
+    ImGui::Checkbox("Sort front to back", &app->enableFrontToBackSort);
+    if (GLEXT_ARB_pipeline_statistics_query)
+        ImGui::Text("Fragment shader invocations: %llu", (unsigned long long)app->fragmentInvocations);
+    else
+        ImGui::Text("Fragment shader invocations: n/a (no ARB_pipeline_statistics_query)");
+
+    ImGui::Text("Uniform buffer: %s, %u stalls", app->cbuffer.persistent ? "persistent" : "unsynchronized", app->cbuffer.stallCount);
+    ImGui::Text("Instance buffer: %s, %u stalls", app->instanceBuffer.persistent ? "persistent" : "unsynchronized", app->instanceBuffer.stallCount);
     
+    // Read back a few frames late, the CPU time is the time spent issuing the commands of the pass
+    const std::vector<GpuTimerResult>& gpuTimers = GetGpuTimerResults();
+    if (!gpuTimers.empty() && ImGui::BeginTable("Pass timings", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Pass");
+        ImGui::TableSetupColumn("CPU (ms)");
+        ImGui::TableSetupColumn("GPU (ms)");
+        ImGui::TableHeadersRow();
+
+        for (u32 i = 0; i < gpuTimers.size(); ++i)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%*s%s", gpuTimers[i].depth * 2, "", gpuTimers[i].name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", gpuTimers[i].cpuMs);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", gpuTimers[i].gpuMs);
+        }
+
+        ImGui::EndTable();
+    }
+
+    ImGui::Checkbox("Debug groups", &app->enableDebugGroups);
+
     for (int i = 0; i < app->info.size(); ++i)
         ImGui::Text(app->info[i].c_str());
 
     ImGui::End();
+
+    ProfilerGui();
+}
+
+void UpdateInstanceParams(App* app, const glm::mat4& viewProjectionMatrix)
+{
+    PROFILE_SCOPE("UpdateInstanceParams");
+
+    // Group the entities by model and level of detail so each group occupies a contiguous block of instances
+    std::vector<u32> groupIndexPerModelLod(app->models.size() * MAX_LODS, UINT32_MAX);
+    app->instanceGroups.clear();
+
+    for (u32 i = 0; i < app->visibleEntities.size(); ++i)
+    {
+        u32 entityIdx = app->visibleEntities[i];
+        const Entity& entity = app->entities[entityIdx];
+        u32 key = entity.modelIndex * MAX_LODS + entity.lod;
+        f32 viewDepth = EntityViewDepth(app, entityIdx);
+        if (groupIndexPerModelLod[key] == UINT32_MAX)
+        {
+            groupIndexPerModelLod[key] = app->instanceGroups.size();
+            app->instanceGroups.push_back(InstanceGroup{ entity.modelIndex, entity.lod, 0, 0, 0, 0, viewDepth });
+        }
+
+        InstanceGroup& group = app->instanceGroups[groupIndexPerModelLod[key]];
+        group.instanceCount++;
+        group.nearestViewDepth = glm::min(group.nearestViewDepth, viewDepth);
+    }
+
+    // Sort the visible entities by group (counting sort)
+    std::vector<u32> groupStart(app->instanceGroups.size() + 1, 0);
+    for (u32 i = 0; i < app->instanceGroups.size(); ++i)
+        groupStart[i + 1] = groupStart[i] + app->instanceGroups[i].instanceCount;
+
+    std::vector<u32> groupedEntities(app->visibleEntities.size());
+    std::vector<u32> groupHead(groupStart.begin(), groupStart.end() - 1);
+    for (u32 i = 0; i < app->visibleEntities.size(); ++i)
+    {
+        u32 entityIdx = app->visibleEntities[i];
+        const Entity& entity = app->entities[entityIdx];
+        u32 groupIdx = groupIndexPerModelLod[entity.modelIndex * MAX_LODS + entity.lod];
+        groupedEntities[groupHead[groupIdx]++] = entityIdx;
+    }
+
+    MapBufferRegion(app->instanceBuffer);
+    app->instanceParamsOffset = app->instanceBuffer.head;
+    app->droppedInstances = 0;
+
+    for (u32 i = 0; i < app->instanceGroups.size(); ++i)
+    {
+        InstanceGroup& group = app->instanceGroups[i];
+
+        // Once the region is full the remaining instances are not drawn. The groups come in the order of
+        // their first visible entity, and the instances of a group in visible order, so with the
+        // front-to-back sort the farthest ones are dropped
+        const u32 capacity = GetRemainingRegionSize(app->instanceBuffer, app->storageBufferAlignment) / INSTANCE_PARAMS_SIZE;
+        if (group.instanceCount > capacity)
+        {
+            app->droppedInstances += group.instanceCount - capacity;
+            group.instanceCount = capacity;
+        }
+
+        if (group.instanceCount == 0)
+            continue;
+
+        // Instances have a power of two size, so aligned groups still start at a whole instance
+        u32 size = group.instanceCount * INSTANCE_PARAMS_SIZE;
+        void* instanceParams = ReserveAlignedData(app->instanceBuffer, size, app->storageBufferAlignment);
+        group.instanceParamsOffset = app->instanceBuffer.head - size;
+        group.instanceParamsSize = size;
+        group.firstInstance = (group.instanceParamsOffset - app->instanceParamsOffset) / INSTANCE_PARAMS_SIZE;
+
+        // All the instances of a group share the mesh, and so the dequantization of its positions
+        const u32* groupEntities = &groupedEntities[groupStart[i]];
+        vec4 dequantization;
+        const vec4* localScaleOffset = GetPositionDequantization(app->meshes[app->models[group.modelIndex].meshIdx], dequantization);
+        ParallelFor(group.instanceCount, TRANSFORM_BATCH_SIZE, [&](u32 begin, u32 end) {
+            TransformWorldViewProjection(app->transformKernel, viewProjectionMatrix, app->worldMatrices.data(), groupEntities + begin,
+                                         end - begin, (u8*)instanceParams + begin * INSTANCE_PARAMS_SIZE, INSTANCE_PARAMS_SIZE, localScaleOffset);
+        });
+    }
+
+    app->instanceParamsSize = app->instanceBuffer.head - app->instanceParamsOffset;
+
+    UnmapBufferRegion(app->instanceBuffer);
+
+    if (app->droppedInstances > 0)
+    {
+        app->instanceGroups.erase(std::remove_if(app->instanceGroups.begin(), app->instanceGroups.end(),
+                                                 [](const InstanceGroup& group) { return group.instanceCount == 0; }),
+                                  app->instanceGroups.end());
+    }
+}
+
+struct IndirectDraw
+{
+    u32 arenaIdx;
+    u32 materialIdx;
+    DrawElementsIndirectCommand command;
+};
+
+void UpdateIndirectCommands(App* app)
+{
+    PROFILE_SCOPE("UpdateIndirectCommands");
+
+    // One command per submesh of every instance group
+    std::vector<IndirectDraw> draws;
+
+    for (u32 i = 0; i < app->instanceGroups.size(); ++i)
+    {
+        InstanceGroup& group = app->instanceGroups[i];
+        Model& model = app->models[group.modelIndex];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        {
+            Submesh& submesh = mesh.submeshes[j];
+            const SubmeshLod& lod = GetSubmeshLod(submesh, group.lod);
+
+            IndirectDraw draw = {};
+            draw.arenaIdx = submesh.arenaIdx;
+            draw.materialIdx = model.materialIdx[j];
+            draw.command.count = lod.indexCount;
+            draw.command.instanceCount = group.instanceCount;
+            draw.command.firstIndex = submesh.firstIndex + lod.firstIndex;
+            draw.command.baseVertex = submesh.baseVertex;
+            draw.command.baseInstance = group.firstInstance;
+            draws.push_back(draw);
+        }
+    }
+
+    // Commands sharing arena and material can be submitted with a single call. The sort is stable
+    // so inside a batch the groups stay in the front-to-back order of their nearest instance
+    std::stable_sort(draws.begin(), draws.end(), [](const IndirectDraw& a, const IndirectDraw& b) {
+        return a.arenaIdx != b.arenaIdx ? a.arenaIdx < b.arenaIdx : a.materialIdx < b.materialIdx;
+    });
+
+    app->indirectBatches.clear();
+    MapBufferRegion(app->indirectBuffer);
+
+    for (u32 i = 0; i < draws.size(); ++i)
+    {
+        IndirectDraw& draw = draws[i];
+
+        if (app->indirectBatches.empty() ||
+            app->indirectBatches.back().arenaIdx != draw.arenaIdx ||
+            app->indirectBatches.back().materialIdx != draw.materialIdx)
+        {
+            AlignHead(app->indirectBuffer, sizeof(u32));
+            app->indirectBatches.push_back(IndirectBatch{ draw.arenaIdx, draw.materialIdx, app->indirectBuffer.head, 0 });
+        }
+
+        PushAlignedData(app->indirectBuffer, &draw.command, sizeof(draw.command), sizeof(u32));
+        app->indirectBatches.back().commandCount++;
+    }
+
+    UnmapBufferRegion(app->indirectBuffer);
 }
 
 void Update(App* app)
 {
-    // Update programs regarding their timestamps
-    for (u64 i = 0; i < app->programs.size(); ++i)
+    if (app->input.keys[K_T] == BUTTON_PRESS)
+        StartTraceCapture(TRACE_CAPTURE_FRAMES);
+
+    UpdateTextureLoads(app);
+
+    // Reload the programs built from the files modified since the last frame, reading each file once
+    std::vector<std::string> changedFiles;
+    PollFileChanges(changedFiles);
+
+    for (u32 i = 0; i < changedFiles.size(); ++i)
     {
-        Program& program = app->programs[i];
-        u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+        const char* filepath = changedFiles[i].c_str();
+        String programSource = ReadTextFile(filepath);
+        u64 currentTimestamp = GetFileLastWriteTimestamp(filepath);
 
-        if (currentTimestamp > program.lastWriteTimestamp)
+        for (u64 j = 0; j < app->programs.size(); ++j)
         {
+            Program& program = app->programs[j];
+            if (program.filepath != changedFiles[i])
+                continue;
+
             glDeleteProgram(program.handle);
-            String programSource = ReadTextFile(program.filepath.c_str());
-            const char* programName = program.programName.c_str();
-            program.handle = CreateProgramFromSource(app, programSource, programName);
+            program.handle = CreateProgram(app, program, programSource);
             program.lastWriteTimestamp = currentTimestamp;
+            ReadVertexInputLayout(program);
         }
     }
 
-    vec3 cameraPos = vec3(0.0f, 2.0f, 7.5f);
+    vec3 cameraPos = app->cameraPosition;
 
     glm::mat4 viewMatrix = glm::lookAt(
         cameraPos,              // the position of your camera, in world space
-        vec3(0.0f, 1.0f, 0.0f), // where you want to look at, in world space
+        app->cameraTarget,      // where you want to look at, in world space
         glm::vec3(0, 1, 0)      // probably glm::vec3(0,1,0), but (0,-1,0) would make you looking upside-down, which can be great too
     );
 
+    // The platform layer skips the frames of a minimized (0x0) window
+    ASSERT(app->displaySize.x > 0 && app->displaySize.y > 0, "The aspect ratio needs a framebuffer with an area");
+
     // Generates a really hard-to-read matrix, but a normal, standard 4x4 matrix nonetheless
     glm::mat4 projectionMatrix = glm::perspective(
         glm::radians(60.0f),    // The vertical Field of View, in radians: the amount of "zoom". Think "camera lens". Usually between 90 (extra wide) and 30 (quite zoomed in)
-        4.0f / 3.0f,            // Aspect Ratio. Depends on the size of your window. Notice that 4/3 == 800/600 == 1280/960, sounds familiar ?
+        (f32)app->displaySize.x / app->displaySize.y, // Aspect Ratio. Depends on the size of your window. Notice that 4/3 == 800/600 == 1280/960, sounds familiar ?
         0.1f,                   // Near clipping plane. Keep as big as possible, or you'll get precision issues.
         100.0f                  // Far clipping plane. Keep as little as possible.
     );
 
+    app->viewMatrix = viewMatrix;
+    app->projectionMatrix = projectionMatrix;
+
+    // Visibility
+    CullEntities(app);
+
+    if (app->enableFrontToBackSort)
+        SortEntitiesFrontToBack(app);
+
+    SelectEntityLods(app);
+
+    // Lights
+    BuildLightClusters(app);
+    UploadLightClusters(app);
+
     // Global parameters
-    MapBuffer(app->cbuffer, GL_WRITE_ONLY);
+    const LightClusters& clusters = app->lightClusters;
+    MapBufferRegion(app->cbuffer);
     app->globalParamsOffset = app->cbuffer.head;
 
     PushVec3(app->cbuffer, cameraPos);
-    PushUInt(app->cbuffer, app->lights.size());
+    PushUInt(app->cbuffer, clusters.lights.size());
+    PushMat4(app->cbuffer, viewMatrix);
+    PushUInt(app->cbuffer, clusters.countX);
+    PushUInt(app->cbuffer, clusters.countY);
+    PushUInt(app->cbuffer, clusters.countZ);
+    PushUInt(app->cbuffer, clusters.directionalLightCount);
+    PushVec4(app->cbuffer, vec4(clusters.nearPlane, clusters.countZ / glm::log(clusters.farPlane / clusters.nearPlane),
+                                (f32)app->displaySize.x, (f32)app->displaySize.y));
+    PushMat4(app->cbuffer, glm::inverse(projectionMatrix * viewMatrix));
+
+    app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
+    ASSERT(app->globalParamsSize <= GLOBAL_PARAMS_RESERVED_SIZE, "The global parameters outgrew the space reserved for them");
+
+    glm::mat4 viewProjectionMatrix = projectionMatrix * viewMatrix;
+
+    // Local parameters
+    if (app->submission != Submission::PerEntity)
+    {
+        UpdateInstanceParams(app, viewProjectionMatrix);
 
-    for (u32 i = 0; i < app->lights.size(); ++i)
+        if (app->submission == Submission::MultiDrawIndirect)
+            UpdateIndirectCommands(app);
+    }
+    else
     {
-        AlignHead(app->cbuffer, sizeof(vec4));
+        // Every entity gets its own aligned block so it can be bound with glBindBufferRange. The ones that
+        // don't fit in the region are not drawn, the farthest ones with the front-to-back sort
+        u32 stride = Align(INSTANCE_PARAMS_SIZE, app->uniformBufferAlignment);
+        u32 capacity = GetRemainingRegionSize(app->cbuffer, app->uniformBufferAlignment) / stride;
+        // visibleEntities stays whole for the stats, only its first count entities are submitted
+        u32 count = glm::min((u32)app->visibleEntities.size(), capacity);
+        app->droppedInstances = app->visibleEntities.size() - count;
+
+        void* localParams = ReserveAlignedData(app->cbuffer, count * stride, app->uniformBufferAlignment);
+        u32 localParamsOffset = app->cbuffer.head - count * stride;
+
+        // Transformed in runs of entities with the same mesh, each run with the dequantization of its positions
+        ParallelFor(count, TRANSFORM_BATCH_SIZE, [&](u32 begin, u32 end) {
+            for (u32 runBegin = begin; runBegin < end; )
+            {
+                const u32 meshIdx = app->models[app->entities[app->visibleEntities[runBegin]].modelIndex].meshIdx;
+                u32 runEnd = runBegin + 1;
+                while (runEnd < end && app->models[app->entities[app->visibleEntities[runEnd]].modelIndex].meshIdx == meshIdx)
+                    runEnd++;
+
+                vec4 dequantization;
+                const vec4* localScaleOffset = GetPositionDequantization(app->meshes[meshIdx], dequantization);
+                TransformWorldViewProjection(app->transformKernel, viewProjectionMatrix, app->worldMatrices.data(), app->visibleEntities.data() + runBegin,
+                                             runEnd - runBegin, (u8*)localParams + runBegin * stride, stride, localScaleOffset);
+                runBegin = runEnd;
+            }
+        });
 
-        Light& light = app->lights[i];
-        PushVec3(app->cbuffer, light.color);
-        PushVec3(app->cbuffer, light.direction);
-        PushVec3(app->cbuffer, light.position);
-        PushUInt(app->cbuffer, light.type);
+        for (u32 i = 0; i < count; ++i)
+        {
+            Entity& entity = app->entities[app->visibleEntities[i]];
+            entity.localParamsOffset = localParamsOffset + i * stride;
+            entity.localParamsSize = INSTANCE_PARAMS_SIZE;
+        }
     }
 
-    app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
+    UnmapBufferRegion(app->cbuffer);
+}
 
-    // Local parameters
-    for (u32 i = 0; i < app->entities.size(); ++i)
+void BindMaterial(App* app, const Material& material, MeshPass pass)
+{
+    if (pass == MeshPass::Depth)
+        return;
+
+    CachedBindTexture(app->glState, 0, app->textures[material.albedoTextureIdx].handle);
+
+    // The forward and deferred shading turn them into the same highlights
+    glUniform1f(SMOOTHNESS_LOCATION, material.smoothness);
+    glUniform1f(SPECULAR_LOCATION, material.specular);
+}
+
+u32 MeshProgramIdx(App* app, MeshPass pass)
+{
+    const u32 programIndices[][3] = {
+        { app->texturedMeshProgramIdx, app->texturedMeshInstancedProgramIdx, app->texturedMeshIndirectProgramIdx }, // Shaded
+        { app->gbufferMeshProgramIdx,  app->gbufferMeshInstancedProgramIdx,  app->gbufferMeshIndirectProgramIdx },  // GBuffer
+        { app->depthMeshProgramIdx,    app->depthMeshInstancedProgramIdx,    app->depthMeshIndirectProgramIdx },    // Depth
+    };
+
+    return programIndices[(u32)pass][(u32)app->submission];
+}
+
+// Adds the draws of a pass to the render queue: one per submesh of every visible entity, or
+// one per submesh of every instance group
+void BuildRenderQueue(App* app, MeshPass pass)
+{
+    const u32 programIdx = MeshProgramIdx(app, pass);
+
+    auto pushSubmeshes = [&](const Model& model, u32 lodIdx, u32 instanceCount, u32 paramsOffset, u32 paramsSize, f32 viewDepth) {
+        const Mesh& mesh = app->meshes[model.meshIdx];
+
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        {
+            const Submesh& submesh = mesh.submeshes[j];
+            const SubmeshLod& lod = GetSubmeshLod(submesh, lodIdx);
+
+            RenderItem item = {};
+            item.programIdx = programIdx;
+            item.arenaIdx = submesh.arenaIdx;
+            item.materialIdx = model.materialIdx[j];
+            item.indexCount = lod.indexCount;
+            item.firstIndex = submesh.firstIndex + lod.firstIndex;
+            item.baseVertex = submesh.baseVertex;
+            item.instanceCount = instanceCount;
+            item.paramsOffset = paramsOffset;
+            item.paramsSize = paramsSize;
+
+            // The depth pre-pass does not sample the material, so its draws are only grouped by geometry
+            const u32 materialKey = pass == MeshPass::Depth ? 0 : item.materialIdx;
+            PushRenderItem(app->renderQueue, MakeSortKey(pass, programIdx, materialKey, item.arenaIdx, viewDepth), item);
+        }
+    };
+
+    if (app->submission == Submission::PerEntity)
+    {
+        // The entities past the ones that fit in the uniform buffer region have no parameters this frame
+        const u32 submittedCount = app->visibleEntities.size() - app->droppedInstances;
+        for (u32 i = 0; i < submittedCount; ++i)
+        {
+            const u32 entityIdx = app->visibleEntities[i];
+            const Entity& entity = app->entities[entityIdx];
+            pushSubmeshes(app->models[entity.modelIndex], entity.lod, 0, entity.localParamsOffset, entity.localParamsSize, EntityViewDepth(app, entityIdx));
+        }
+    }
+    else
+    {
+        for (u32 i = 0; i < app->instanceGroups.size(); ++i)
+        {
+            const InstanceGroup& group = app->instanceGroups[i];
+            pushSubmeshes(app->models[group.modelIndex], group.lod, group.instanceCount, group.instanceParamsOffset, group.instanceParamsSize, group.nearestViewDepth);
+        }
+    }
+}
+
+// Submits the draws of a pass in key order, so consecutive draws mostly share their state
+void ExecuteRenderQueue(App* app, MeshPass pass)
+{
+    const RenderQueue& queue = app->renderQueue;
+    GLStateCache& state = app->glState;
+
+    u32 begin, end;
+    GetRenderQueueRange(queue, pass, &begin, &end);
+
+    u32 currentProgramIdx = UINT32_MAX;
+    u32 currentMaterialIdx = UINT32_MAX;
+
+    for (u32 i = begin; i < end; ++i)
+    {
+        const RenderItem& item = queue.items[queue.order[i]];
+        const Program& program = app->programs[item.programIdx];
+
+        CachedUseProgram(state, program.handle);
+        CachedBindBufferRange(state, GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+        if (pass != MeshPass::Depth)
+            BindLightClusters(app);
+
+        if (item.instanceCount == 0)
+            CachedBindBufferRange(state, GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, item.paramsOffset, item.paramsSize);
+        else
+            CachedBindBufferRange(state, GL_SHADER_STORAGE_BUFFER, BINDING(2), app->instanceBuffer.handle, item.paramsOffset, item.paramsSize);
+
+        BindArenaVAO(app, item.arenaIdx, program, pass == MeshPass::Depth);
+
+        // The smoothness uniform belongs to the program, so it is set again after a program change
+        if (item.programIdx != currentProgramIdx || item.materialIdx != currentMaterialIdx)
+        {
+            BindMaterial(app, app->materials[item.materialIdx], pass);
+            currentProgramIdx = item.programIdx;
+            currentMaterialIdx = item.materialIdx;
+        }
+
+        // Draw elements, all the instances of the group at once when instanced
+        const GLenum indexType = app->arenas[item.arenaIdx].indexType;
+        void* indexOffset = (void*)(u64)(item.firstIndex * GetIndexTypeSize(indexType));
+        if (item.instanceCount == 0)
+            glDrawElementsBaseVertex(GL_TRIANGLES, item.indexCount, indexType, indexOffset, item.baseVertex);
+        else
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.indexCount, indexType, indexOffset, item.instanceCount, item.baseVertex);
+        app->drawCalls++;
+    }
+}
+
+void RenderMultiDrawIndirect(App* app, u32 programIdx, MeshPass pass)
+{
+    // Bind the program
+    Program& texturedMeshIndirectProgram = app->programs[programIdx];
+    CachedUseProgram(app->glState, texturedMeshIndirectProgram.handle);
+
+    // The instances of the whole frame are bound at once, each command selects its own with baseInstance
+    CachedBindBufferRange(app->glState, GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    if (pass != MeshPass::Depth)
+        BindLightClusters(app);
+    CachedBindBufferRange(app->glState, GL_SHADER_STORAGE_BUFFER, BINDING(2), app->instanceBuffer.handle, app->instanceParamsOffset, app->instanceParamsSize);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->indirectBuffer.handle);
+
+    for (u32 i = 0; i < app->indirectBatches.size(); ++i)
     {
-        AlignHead(app->cbuffer, app->uniformBufferAlignment);
+        IndirectBatch& batch = app->indirectBatches[i];
+
+        BindArenaVAO(app, batch.arenaIdx, texturedMeshIndirectProgram, pass == MeshPass::Depth);
 
-        Entity&     entity = app->entities[i];
-        glm::mat4   world = entity.worldMatrix;
-        glm::mat4   worldViewProjection = projectionMatrix * viewMatrix * world;
+        BindMaterial(app, app->materials[batch.materialIdx], pass);
 
-        entity.localParamsOffset = app->cbuffer.head;
-        PushMat4(app->cbuffer, world);
-        PushMat4(app->cbuffer, worldViewProjection);
-        entity.localParamsSize = app->cbuffer.head - entity.localParamsOffset;
+        glMultiDrawElementsIndirect(GL_TRIANGLES, app->arenas[batch.arenaIdx].indexType, (void*)(u64)batch.commandsOffset, batch.commandCount, 0);
+        app->drawCalls++;
     }
 
-    UnmapBuffer(app->cbuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
-void Render(App* app)
+// Draws the visible entities with the submission method selected in the Gui
+void RenderMeshes(App* app, MeshPass pass)
 {
-    if (app->enableDebugGroups) 
-        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Shaded model");
+    if (app->submission == Submission::MultiDrawIndirect)
+        RenderMultiDrawIndirect(app, MeshProgramIdx(app, pass), pass);
+    else
+        ExecuteRenderQueue(app, pass);
+}
 
-    // Clear the framebuffer
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void BeginFragmentQuery(App* app)
+{
+    if (!GLEXT_ARB_pipeline_statistics_query)
+        return;
 
-    // Set the viewport
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    // Read the query issued FRAGMENT_QUERY_COUNT frames ago before reusing it
+    GLuint query = app->fragmentQueries[app->fragmentQueryFrame % FRAGMENT_QUERY_COUNT];
 
-    switch (app->mode)
+    if (app->fragmentQueryFrame >= FRAGMENT_QUERY_COUNT)
     {
-        case Mode::TexturedQuad:
-        {
-            // Bind the program
-            Program& texturedGeometryProgram = app->programs[app->texturedGeometryProgramIdx];
-            glUseProgram(texturedGeometryProgram.handle);
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &app->fragmentInvocations);
+    }
+
+    glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, query);
+}
+
+void EndFragmentQuery(App* app)
+{
+    if (!GLEXT_ARB_pipeline_statistics_query)
+        return;
+
+    glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+    app->fragmentQueryFrame++;
+}
+
+// Draws the opaque meshes, laying down their depth first when the pre-pass is enabled so the
+// expensive pass only shades the fragments that end up visible
+void RenderOpaqueMeshes(App* app, MeshPass pass)
+{
+    if (app->enableDepthPrepass)
+    {
+        GPU_SCOPE("Depth pre-pass", app->enableDebugGroups);
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        RenderMeshes(app, MeshPass::Depth);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    {
+        GPU_SCOPE(pass == MeshPass::GBuffer ? "G-buffer pass" : "Forward pass", app->enableDebugGroups);
+
+        BeginFragmentQuery(app);
+        RenderMeshes(app, pass);
+        EndFragmentQuery(app);
+    }
+
+    if (app->enableDepthPrepass)
+    {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+}
+
+void CreateGBuffer(GBuffer& gbuffer, ivec2 size)
+{
+    if (gbuffer.framebuffer)
+    {
+        GLuint textures[] = { gbuffer.albedoSmoothness, gbuffer.normals, gbuffer.specular, gbuffer.depth };
+        glDeleteTextures(ARRAY_COUNT(textures), textures);
+        glDeleteFramebuffers(1, &gbuffer.framebuffer);
+    }
+
+    auto createAttachment = [size](GLenum internalFormat, GLenum format, GLenum type) {
+        GLuint texHandle;
+        glGenTextures(1, &texHandle);
+        glBindTexture(GL_TEXTURE_2D, texHandle);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texHandle;
+    };
+
+    gbuffer.size = size;
+    gbuffer.albedoSmoothness = createAttachment(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    gbuffer.normals = createAttachment(GL_RG16F, GL_RG, GL_FLOAT);
+    gbuffer.specular = createAttachment(GL_R8, GL_RED, GL_UNSIGNED_BYTE);
+    gbuffer.depth = createAttachment(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &gbuffer.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gbuffer.albedoSmoothness, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gbuffer.normals, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gbuffer.specular, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gbuffer.depth, 0);
+
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        ELOG("G-buffer framebuffer is incomplete (0x%x)", status);
 
-            // Bind the vao       
-            glBindVertexArray(app->vao);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Render(App* app)
+{
+    GpuTimersBeginFrame();
 
-            // Set the blending state
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    {
+        GPU_SCOPE("Shaded model", app->enableDebugGroups);
 
-            // Bind the texture into unit 0
-            glActiveTexture(GL_TEXTURE0);
+        app->drawCalls = 0;
 
-            GLuint textureHandle = app->textures[app->diceTexIdx].handle;
-            glBindTexture(GL_TEXTURE_2D, textureHandle);
+        // ImGui and the loading code bind through GL directly
+        ResetStateCache(app->glState);
+        app->glState.bindsIssued = 0;
+        app->glState.bindsSkipped = 0;
 
-            // Draw elements
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+        // Per-entity and instanced draws are sorted by state before submission
+        ClearRenderQueue(app->renderQueue);
+        if (app->mode != Mode::TexturedQuad && app->submission != Submission::MultiDrawIndirect)
+        {
+            PROFILE_SCOPE("BuildRenderQueue");
+            if (app->enableDepthPrepass)
+                BuildRenderQueue(app, MeshPass::Depth);
+            BuildRenderQueue(app, app->mode == Mode::Deferred ? MeshPass::GBuffer : MeshPass::Shaded);
+            SortRenderQueue(app->renderQueue);
         }
-        break;
 
-        case Mode::TexturedMesh:
+        // Clear the framebuffer
+        glBindFramebuffer(GL_FRAMEBUFFER, app->outputFramebuffer);
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Set the viewport
+        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+
+        switch (app->mode)
         {
-            // Bind the program
-            Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
-            glUseProgram(texturedMeshProgram.handle);
+            case Mode::TexturedQuad:
+            {
+                GPU_SCOPE("Textured quad", app->enableDebugGroups);
+
+                // Bind the program
+                Program& texturedGeometryProgram = app->programs[app->texturedGeometryProgramIdx];
+                CachedUseProgram(app->glState, texturedGeometryProgram.handle);
+
+                // Bind the vao       
+                CachedBindVertexArray(app->glState, app->vao);
+
+                // Set the blending state
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-            for (int i = 0; i < app->entities.size(); ++i)
+                // Bind the texture into unit 0
+                GLuint textureHandle = app->textures[app->diceTexIdx].handle;
+                CachedBindTexture(app->glState, 0, textureHandle);
+
+                // Draw elements
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+                app->drawCalls++;
+
+                // The mesh passes are opaque, and the G-buffer targets have no alpha to blend with
+                glDisable(GL_BLEND);
+            }
+            break;
+
+            case Mode::TexturedMesh:
+            {
+                RenderOpaqueMeshes(app, MeshPass::Shaded);
+            }
+            break;
+
+            case Mode::Deferred:
             {
-                Model& model = app->models[app->entities[i].modelIndex];
-                Mesh& mesh = app->meshes[model.meshIdx];
+                if (app->gbuffer.size != app->displaySize)
+                    CreateGBuffer(app->gbuffer, app->displaySize);
+
+                // Geometry pass
+                glBindFramebuffer(GL_FRAMEBUFFER, app->gbuffer.framebuffer);
+                glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                RenderOpaqueMeshes(app, MeshPass::GBuffer);
 
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
+                glBindFramebuffer(GL_FRAMEBUFFER, app->outputFramebuffer);
 
-                for (u32 j = 0; j < mesh.submeshes.size(); ++j)
-                {
-                    GLuint vao = FindVAO(mesh, j, texturedMeshProgram);
-                    glBindVertexArray(vao);
+                // Lighting pass, once per pixel no matter the overdraw of the geometry pass
+                GPU_SCOPE("Deferred lighting", app->enableDebugGroups);
 
-                    u32 submeshMaterialIdx = model.materialIdx[j];
-                    Material& submeshMaterial = app->materials[submeshMaterialIdx];
+                Program& deferredLightingProgram = app->programs[app->deferredLightingProgramIdx];
+                CachedUseProgram(app->glState, deferredLightingProgram.handle);
+                glUniform1i(GBUFFER_VIEW_LOCATION, (GLint)app->gbufferView);
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-                    //glUniform1i(app->programMeshTexture, 0);
+                CachedBindBufferRange(app->glState, GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+                BindLightClusters(app);
 
-                    // Draw elements
-                    Submesh& submesh = mesh.submeshes[j];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                }
+                CachedBindTexture(app->glState, 0, app->gbuffer.albedoSmoothness);
+                CachedBindTexture(app->glState, 1, app->gbuffer.normals);
+                CachedBindTexture(app->glState, 2, app->gbuffer.depth);
+                CachedBindTexture(app->glState, 3, app->gbuffer.specular);
+
+                glDisable(GL_DEPTH_TEST);
+                CachedBindVertexArray(app->glState, app->vao);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+                app->drawCalls++;
+                glEnable(GL_DEPTH_TEST);
             }
+            break;
         }
-        break;
     }
 
-    if (app->enableDebugGroups)
-        glPopDebugGroup();
-
+    glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(0);
     glUseProgram(0);
+
+    // The GPU reads this frame's parameters until the fence is signaled
+    FenceBufferRegion(app->cbuffer);
+    FenceBufferRegion(app->instanceBuffer);
+    FenceBufferRegion(app->indirectBuffer);
+    FenceBufferRegion(app->lightBuffer);
 }
\ No newline at end of file
@@ -5,7 +5,12 @@
 #pragma once
 
 #include "platform.h"
-#include <glad/glad.h>
+#include "glext.h"
+#include "jobs.h"
+#include "transforms.h"
+
+#include <atomic>
+#include <unordered_map>
 
 #define BINDING(b) b
 
@@ -16,12 +21,6 @@ typedef glm::ivec2 ivec2;
 typedef glm::ivec3 ivec3;
 typedef glm::ivec4 ivec4;
 
-struct Vao
-{
-    GLuint handle;
-    GLuint programHandle;
-};
-
 struct Image
 {
     void* pixels;
@@ -30,10 +29,28 @@ struct Image
     i32   stride;
 };
 
+enum TextureState
+{
+    TextureState_Loading,  // Decoding or waiting for upload, the handle is a placeholder
+    TextureState_Resident,
+    TextureState_Failed    // Could not be decoded, the handle is a placeholder
+};
+
 struct Texture
 {
-    GLuint      handle;
-    std::string filepath;
+    GLuint       handle;
+    std::string  filepath;
+    TextureState state;
+};
+
+// Texture decoded by a job, waiting for the main thread to upload it
+struct TextureLoad
+{
+    u32               textureIdx;
+    std::string       filepath;
+    Image             image;
+    std::atomic<bool> decoded;
+    std::atomic<bool> cancelled;    // the decode is skipped if it hasn't started yet
 };
 
 struct VertexV3V2
@@ -44,9 +61,11 @@ struct VertexV3V2
 
 struct VertexBufferAttribute
 {
-    u8 location;
-    u8 componentCount;
-    u8 offset;
+    u8     location;
+    u8     componentCount;
+    u8     offset;
+    GLenum type;        // of each component, e.g. GL_FLOAT or GL_HALF_FLOAT
+    u8     normalized;  // integer components are mapped to [0, 1] or [-1, 1]
 };
 
 struct VertexBufferLayout
@@ -72,6 +91,7 @@ struct Material
     vec3 albedo;
     vec3 emissive;
     f32 smoothness;
+    f32 specular;       // intensity of the specular highlights, 0 for matte materials
     u32 albedoTextureIdx;
     u32 emissiveTextureIdx;
     u32 specularTextureIdx;
@@ -79,21 +99,80 @@ struct Material
     u32 bumpTextureIdx;
 };
 
+struct BoundingVolume
+{
+    vec3 aabbMin;
+    vec3 aabbMax;
+    vec3 sphereCenter;
+    f32  sphereRadius;
+};
+
+#define MAX_LODS 5
+
+// Index range of a level of detail, relative to the first index of its submesh
+struct SubmeshLod
+{
+    u32 firstIndex;
+    u32 indexCount;
+};
+
 struct Submesh
 {
-    u32 vertexOffset;
-    u32 indexOffset;
-    std::vector<float>  vertices;
-    std::vector<u32>    indices;
-    std::vector<Vao>    vaos;
+    u32 arenaIdx;
+    u32 baseVertex;     // first vertex of the submesh in its arena
+    u32 firstIndex;     // first index of the submesh in its arena
+    std::vector<float>  vertices;   // CPU copies, empty once uploaded unless the mesh keeps its CPU data
+    std::vector<u32>    indices;    // of every level of detail, one after the other
+    u32                 vertexCount;
+    u32                 indexCount;
+    GLenum              indexType;  // stored in the arena as GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    std::vector<SubmeshLod> lods;   // lods[0] is the full detail mesh
     VertexBufferLayout  vertexBufferLayout;
+    BoundingVolume      bounds;
 };
 
 struct Mesh
 {
-    GLuint vertexBufferHandle;
-    GLuint indexBufferHandle;
+    std::string          name;
     std::vector<Submesh> submeshes;
+    BoundingVolume       bounds;
+    bool                 keepCpuData;   // vertices and indices stay in memory after the upload (picking, physics...)
+    vec3                 positionOffset = vec3(0.0f);  // compressed positions are positionOffset + positionScale * position
+    f32                  positionScale = 1.0f;
+};
+
+// Vertex and index storage shared by all the submeshes with the same vertex layout and index type,
+// so they can be drawn without rebinding buffers (e.g. with glMultiDrawElementsIndirect)
+struct GeometryArena
+{
+    VertexBufferLayout  vertexBufferLayout;
+    GLenum              indexType;
+    GLuint              vertexBufferHandle;
+    VertexBufferLayout  positionLayout;         // of the position stream: the position attribute alone, 4-byte aligned
+    GLuint              positionBufferHandle;   // tightly packed copy of the positions, read by the depth pre-pass
+    GLuint              indexBufferHandle;
+    u32                 vertexCount;
+    u32                 indexCount;
+    u32                 vertexCapacity;
+    u32                 indexCapacity;
+};
+
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 baseInstance;
+};
+
+// Consecutive indirect commands that share arena and material
+struct IndirectBatch
+{
+    u32 arenaIdx;
+    u32 materialIdx;
+    u32 commandsOffset;
+    u32 commandCount;
 };
 
 struct Model
@@ -107,10 +186,13 @@ struct Program
     GLuint              handle;
     std::string         filepath;
     std::string         programName;
+    std::string         defines;            // Extra #define lines added after the program name
     u64                 lastWriteTimestamp;
     VertexShaderLayout  vertexInputLayout;
 };
 
+#define MAX_BUFFER_REGIONS 4
+
 struct Buffer
 {
     GLuint  handle;
@@ -118,17 +200,41 @@ struct Buffer
     u32     size;
     u32     head;
     void*   data; // mapped data
+
+    // Ring buffer regions (only used by persistent buffers)
+    bool    persistent;
+    u32     regionCount;
+    u32     regionSize;
+    u32     regionIdx;
+    u32     regionEnd;
+    GLsync  fences[MAX_BUFFER_REGIONS];
+    u32     stallCount;
+
+    u64     bytesWritten;   // since the buffer was created, through PushAlignedData/ReserveAlignedData
 };
 
+// The world matrix of an entity is app->worldMatrices[entityIndex] (see AddEntity)
 struct Entity
 {
-    Entity(glm::mat4 worldMatrix, u32 modelIndex, u32 localParamsOffset, u32 localParamsSize)
-        : worldMatrix(worldMatrix), modelIndex(modelIndex), localParamsOffset(localParamsOffset), localParamsSize(localParamsSize) {}
+    Entity(u32 modelIndex, u32 localParamsOffset, u32 localParamsSize)
+        : modelIndex(modelIndex), localParamsOffset(localParamsOffset), localParamsSize(localParamsSize), lod(0) {}
     
-    glm::mat4   worldMatrix;
     u32         modelIndex;
     u32         localParamsOffset;
     u32         localParamsSize;
+    u32         lod;    // level of detail chosen in the last update
+};
+
+// Entities sharing the same model and level of detail, drawn with a single instanced call per submesh
+struct InstanceGroup
+{
+    u32 modelIndex;
+    u32 lod;
+    u32 firstInstance;  // relative to the start of the frame's instance region
+    u32 instanceCount;
+    u32 instanceParamsOffset;
+    u32 instanceParamsSize;
+    f32 nearestViewDepth;   // of the closest instance, used to sort the group
 };
 
 enum LightType
@@ -139,19 +245,147 @@ enum LightType
 
 struct Light
 {
-    Light(LightType type, vec3 color, vec3 direction, vec3 position)
-        : type(type), color(color), direction(direction), position(position) {}
+    Light(LightType type, vec3 color, vec3 direction, vec3 position, f32 radius = 10.0f)
+        : type(type), color(color), direction(direction), position(position), radius(radius) {}
 
     vec3        color;
     vec3        direction;
     vec3        position;
     LightType   type;
+    f32         radius;     // Distance at which a point light stops affecting the scene
+};
+
+// Light as stored in the light storage buffer (std430 layout)
+struct GpuLight
+{
+    vec3 color;
+    u32  type;
+    vec3 direction;
+    f32  radius;
+    vec3 position;
+    f32  padding;
+};
+
+// Froxel grid of the clustered forward lighting, rebuilt every frame by BuildLightClusters
+struct LightClusters
+{
+    u32 countX;
+    u32 countY;
+    u32 countZ;
+    u32 capacity;                   // Maximum number of lights per cluster
+    f32 nearPlane;
+    f32 farPlane;
+    glm::mat4 projectionMatrix;     // Projection the bounds were built for
+    std::vector<vec3> boundsMin;    // View space bounds of every cluster
+    std::vector<vec3> boundsMax;
+    std::vector<u32>  lightCounts;  // Lights assigned to every cluster
+    std::vector<u32>  lightIndices; // capacity indices per cluster
+    std::vector<GpuLight> lights;   // Directional lights first
+    u32 directionalLightCount;
+    u32 assignedLightCount;         // Sum of lightCounts
+    u32 overflowCount;              // Light/cluster pairs dropped because a cluster was full
 };
 
 enum class Mode
 {
     TexturedQuad,
     TexturedMesh,
+    Deferred,
+    Count
+};
+
+// Attachment shown by the deferred lighting pass instead of the lit image
+enum class GBufferView
+{
+    Lit,
+    Albedo,
+    Smoothness,
+    Normals,
+    Depth,
+    Position,
+    Specular,
+    Count
+};
+
+// Render targets of the deferred geometry pass, 13 bytes per pixel
+struct GBuffer
+{
+    GLuint framebuffer;
+    GLuint albedoSmoothness;    // RGBA8: albedo and material smoothness
+    GLuint normals;             // RG16F: octahedral encoded worldspace normal
+    GLuint specular;            // R8: material specular intensity
+    GLuint depth;               // Depth24, positions are reconstructed from it
+    ivec2  size;
+};
+
+// What the mesh programs write: the shaded color, the G-buffer or only depth
+enum class MeshPass
+{
+    Shaded,
+    GBuffer,
+    Depth
+};
+
+// One draw of the render queue. The queue sorts them by key and submits them in that order
+struct RenderItem
+{
+    u32 programIdx;
+    u32 arenaIdx;
+    u32 materialIdx;
+    u32 indexCount;
+    u32 firstIndex;
+    u32 baseVertex;
+    u32 instanceCount;  // 0 for a per-entity draw, which reads its LocalParams from the uniform buffer
+    u32 paramsOffset;   // range of the LocalParams (per-entity) or InstanceParams (instanced)
+    u32 paramsSize;
+};
+
+struct RenderQueue
+{
+    std::vector<RenderItem> items;
+    std::vector<u64> keys;      // sort key of every item
+    std::vector<u32> order;     // item indices, in key order once sorted
+    std::vector<u64> scratchKeys;
+    std::vector<u32> scratchOrder;
+};
+
+#define STATE_CACHE_TEXTURE_UNITS   8
+#define STATE_CACHE_BUFFER_BINDINGS 8
+#define STATE_CACHE_VERTEX_BINDINGS 2
+
+struct BufferRangeBinding
+{
+    GLuint buffer;
+    u32    offset;
+    u32    size;
+};
+
+// Last state set through the Cached* functions, so binds that would not change anything are skipped.
+// It only knows about the state set through it, so it is reset whenever other code may have touched GL
+struct GLStateCache
+{
+    GLuint program;
+    GLuint vertexArray;
+    GLuint vertexBuffers[STATE_CACHE_VERTEX_BINDINGS];  // of the bound vao
+    GLuint elementBuffer;                               // of the bound vao
+    u32    activeTexture;
+    GLuint textures[STATE_CACHE_TEXTURE_UNITS];
+    BufferRangeBinding uniformBuffers[STATE_CACHE_BUFFER_BINDINGS];
+    BufferRangeBinding storageBuffers[STATE_CACHE_BUFFER_BINDINGS];
+
+    u32 bindsIssued;
+    u32 bindsSkipped;
+};
+
+// Queries in flight, so results are read a few frames late instead of stalling
+#define FRAGMENT_QUERY_COUNT 3
+
+// How the TexturedMesh pass submits its draw calls
+enum class Submission
+{
+    PerEntity,
+    Instanced,
+    MultiDrawIndirect,
     Count
 };
 
@@ -161,6 +395,7 @@ struct App
     f32  deltaTime;
     bool isRunning;
     bool enableDebugGroups = false;
+    Submission submission = Submission::Instanced;
 
     // Input
     Input input;
@@ -171,14 +406,30 @@ struct App
 
     ivec2 displaySize;
 
+    // Framebuffer the frames are rendered into: the window's (0), or an offscreen one when headless
+    GLuint outputFramebuffer;
+    bool   headless;
+
     std::vector<Texture>  textures;
     std::vector<Material> materials;
     std::vector<Mesh>     meshes;
+    std::vector<GeometryArena> arenas;
+
+    // Vaos shared by all the geometry with the same vertex/program input layouts
+    std::unordered_map<u64, GLuint> vaoCache;
     std::vector<Model>    models;
     std::vector<Program>  programs;
     std::vector<Entity>   entities;
+    AlignedVector<glm::mat4> worldMatrices;
     std::vector<Light>    lights;
 
+    // Asynchronous texture loading
+    std::vector<TextureLoad*> textureLoads;
+    JobCounter textureDecodeCounter;
+    GLuint textureStagingBuffer;
+    f32    textureUploadBudgetMs = 2.0f;
+    u64    textureBytesUploaded;
+
     // Texture indices
     u32 diceTexIdx;
     u32 whiteTexIdx;
@@ -189,22 +440,98 @@ struct App
     // Model indices
     u32 model;
 
+    // Program binary cache
+    u32 programCacheHits;
+    u32 programCacheMisses;
+
     // Program indices
     u32 texturedGeometryProgramIdx;
     u32 texturedMeshProgramIdx;
+    u32 texturedMeshInstancedProgramIdx;
+    u32 texturedMeshIndirectProgramIdx;
+    u32 gbufferMeshProgramIdx;
+    u32 gbufferMeshInstancedProgramIdx;
+    u32 gbufferMeshIndirectProgramIdx;
+    u32 deferredLightingProgramIdx;
+    u32 depthMeshProgramIdx;
+    u32 depthMeshInstancedProgramIdx;
+    u32 depthMeshIndirectProgramIdx;
 
     // Mode
     Mode mode;
 
+    // Deferred shading
+    GBuffer gbuffer;
+    GBufferView gbufferView;
+
     // Uniform buffer
     GLint uniformBufferAlignment;
     GLint maxUniformBufferSize;
+    GLint storageBufferAlignment;
 
     // Global parameters
     u32 globalParamsOffset;
     u32 globalParamsSize;
     Buffer cbuffer;
 
+    // Per-instance parameters (instanced rendering)
+    Buffer instanceBuffer;
+    u32 instanceParamsOffset;
+    u32 instanceParamsSize;
+    std::vector<InstanceGroup> instanceGroups;
+    u32 droppedInstances;   // visible instances that didn't fit in the instance buffer region this frame
+
+    // Multi-draw-indirect submission
+    Buffer indirectBuffer;
+    GLuint instanceIdBuffer; // 0..MAX_INSTANCES-1, fetched with divisor 1 so baseInstance selects the instance
+    std::vector<IndirectBatch> indirectBatches;
+
+    // Per-entity and instanced submission
+    RenderQueue renderQueue;
+    GLStateCache glState;
+
+    // Clustered forward lighting
+    bool enableClusteredLighting = true;
+    LightClusters lightClusters;
+    Buffer lightBuffer;
+    u32 lightsOffset;
+    u32 lightsSize;
+    u32 clusterRangesOffset;
+    u32 clusterRangesSize;
+    u32 clusterLightsOffset;
+    u32 clusterLightsSize;
+
+    // Camera
+    vec3      cameraPosition;
+    vec3      cameraTarget;
+    glm::mat4 viewMatrix;
+    glm::mat4 projectionMatrix;
+
+    // Transforms
+    TransformKernel transformKernel;
+
+    // Culling
+    bool enableFrustumCulling = true;
+    std::vector<u32> visibleEntities;
+
+    // Levels of detail
+    bool enableLods = true;
+    u32 triangleCount;              // drawn by the visible entities this frame
+    u32 fullDetailTriangleCount;    // the visible entities would draw without levels of detail
+    u32 lodEntityCounts[MAX_LODS];  // visible entities per level
+
+    // Depth pre-pass, the shaded pass then only runs for the visible fragments
+    bool enableDepthPrepass = true;
+    bool enableFrontToBackSort = true;
+
+    // Stats
+    u32 drawCalls;
+
+    // Fragment shader invocations of the shaded (or G-buffer) mesh pass, FRAGMENT_QUERY_COUNT frames late
+    GLuint   fragmentQueries[FRAGMENT_QUERY_COUNT];
+    u32      fragmentQueryFrame;
+    GLuint64 fragmentInvocations;
+
     // Embedded geometry (in-editor simple meshes such as
     // a screen filling quad, a cube, a sphere...)
     GLuint embeddedVertices;
@@ -229,4 +556,31 @@ void Update(App* app);
 
 void Render(App* app);
 
-u32 LoadTexture2D(App* app, const char* filepath);
\ No newline at end of file
+// Returns immediately, the texture uses a placeholder until it's uploaded by UpdateTextureLoads()
+u32 LoadTexture2D(App* app, const char* filepath);
+
+// Blocks until all the textures are uploaded
+void LoadTextures2D(App* app, const char** filepaths, u32 count, u32* textureIndices);
+
+void UpdateTextureLoads(App* app);
+
+/**
+ * Cancels the decodes that haven't started, waits for the running ones and frees
+ * every load that was not uploaded. Must run before the job system shuts down.
+ */
+void CancelTextureLoads(App* app);
+
+u32 AddEntity(App* app, const glm::mat4& worldMatrix, u32 modelIndex);
+
+// Narrowest index type able to address vertexCount vertices
+GLenum ChooseIndexType(u32 vertexCount);
+
+u32 GetIndexTypeSize(GLenum indexType);
+
+void AddSubmeshToArena(App* app, Submesh& submesh);
+
+// Most visible entities a frame can draw with a submission method, the rest are dropped (see droppedInstances)
+u32 GetMaxSubmittedEntities(const App* app, Submission submission);
+
+// Frees the CPU copies of the vertices and indices of a mesh whose submeshes are already in their arenas
+void ReleaseMeshCpuData(Mesh& mesh);
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "filewatcher.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+    #include <sys/inotify.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+#define FILE_CHANGE_QUEUE_SIZE 256
+#define FILE_WATCHER_PERIOD_MS 100
+
+struct WatchedFile
+{
+    std::string filepath;
+    std::string filename;           // Name inside its directory, as reported by inotify
+    u64         lastWriteTimestamp;
+    int         watchDescriptor;    // inotify watch of the directory of the file
+};
+
+// Lock-free queue with the watcher thread as the only producer and the main thread as the only consumer
+struct FileChangeQueue
+{
+    u32              fileIndices[FILE_CHANGE_QUEUE_SIZE];
+    std::atomic<u32> head{ 0 };
+    std::atomic<u32> tail{ 0 };
+};
+
+static FileChangeQueue          GlobalFileChanges;
+static std::vector<WatchedFile> GlobalWatchedFiles;
+static std::mutex               GlobalWatchedFilesMutex;
+static std::thread              GlobalWatcherThread;
+static std::atomic<bool>        GlobalWatcherRunning{ false };
+static int                      GlobalInotifyFd = -1;
+
+static bool PushFileChange(u32 fileIdx)
+{
+    u32 tail = GlobalFileChanges.tail.load(std::memory_order_relaxed);
+    u32 nextTail = (tail + 1) % FILE_CHANGE_QUEUE_SIZE;
+    if (nextTail == GlobalFileChanges.head.load(std::memory_order_acquire))
+        return false;
+
+    GlobalFileChanges.fileIndices[tail] = fileIdx;
+    GlobalFileChanges.tail.store(nextTail, std::memory_order_release);
+    return true;
+}
+
+static bool PopFileChange(u32& fileIdx)
+{
+    u32 head = GlobalFileChanges.head.load(std::memory_order_relaxed);
+    if (head == GlobalFileChanges.tail.load(std::memory_order_acquire))
+        return false;
+
+    fileIdx = GlobalFileChanges.fileIndices[head];
+    GlobalFileChanges.head.store((head + 1) % FILE_CHANGE_QUEUE_SIZE, std::memory_order_release);
+    return true;
+}
+
+static void PushFileChanges(const std::vector<u32>& fileIndices)
+{
+    // The queue is drained every frame, so when it's full it's enough to wait a bit
+    for (u32 i = 0; i < fileIndices.size(); ++i)
+        while (!PushFileChange(fileIndices[i]) && GlobalWatcherRunning)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void FileWatcherMain()
+{
+    ProfilerSetThreadName("File watcher");
+
+    std::vector<u32> changedFiles;
+
+    while (GlobalWatcherRunning)
+    {
+        changedFiles.clear();
+
+#if defined(__linux__)
+        pollfd pollDescriptor = { GlobalInotifyFd, POLLIN, 0 };
+        if (poll(&pollDescriptor, 1, FILE_WATCHER_PERIOD_MS) <= 0)
+            continue;
+
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length = read(GlobalInotifyFd, buffer, sizeof(buffer));
+
+        std::lock_guard<std::mutex> lock(GlobalWatchedFilesMutex);
+        for (char* ptr = buffer; ptr < buffer + length; ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len)
+        {
+            const inotify_event* event = (const inotify_event*)ptr;
+            if (event->len == 0)
+                continue;
+
+            for (u32 i = 0; i < GlobalWatchedFiles.size(); ++i)
+                if (GlobalWatchedFiles[i].watchDescriptor == event->wd && GlobalWatchedFiles[i].filename == event->name)
+                    changedFiles.push_back(i);
+        }
+#else
+        std::this_thread::sleep_for(std::chrono::milliseconds(FILE_WATCHER_PERIOD_MS));
+
+        std::lock_guard<std::mutex> lock(GlobalWatchedFilesMutex);
+        for (u32 i = 0; i < GlobalWatchedFiles.size(); ++i)
+        {
+            u64 currentTimestamp = GetFileLastWriteTimestamp(GlobalWatchedFiles[i].filepath.c_str());
+            if (currentTimestamp > GlobalWatchedFiles[i].lastWriteTimestamp)
+            {
+                GlobalWatchedFiles[i].lastWriteTimestamp = currentTimestamp;
+                changedFiles.push_back(i);
+            }
+        }
+#endif
+
+        PushFileChanges(changedFiles);
+    }
+}
+
+void StartFileWatcher()
+{
+    ASSERT(!GlobalWatcherRunning, "The file watcher is already running");
+
+#if defined(__linux__)
+    GlobalInotifyFd = inotify_init1(IN_NONBLOCK);
+    if (GlobalInotifyFd < 0)
+    {
+        ELOG("inotify_init1() failed, hot reload is disabled");
+        return;
+    }
+#endif
+
+    GlobalWatcherRunning = true;
+    GlobalWatcherThread = std::thread(FileWatcherMain);
+}
+
+void StopFileWatcher()
+{
+    if (!GlobalWatcherRunning)
+        return;
+
+    GlobalWatcherRunning = false;
+    GlobalWatcherThread.join();
+
+#if defined(__linux__)
+    close(GlobalInotifyFd);
+    GlobalInotifyFd = -1;
+#endif
+
+    GlobalWatchedFiles.clear();
+    GlobalFileChanges.head = 0;
+    GlobalFileChanges.tail = 0;
+}
+
+void WatchFile(const char* filepath)
+{
+    std::lock_guard<std::mutex> lock(GlobalWatchedFilesMutex);
+
+    for (u32 i = 0; i < GlobalWatchedFiles.size(); ++i)
+        if (GlobalWatchedFiles[i].filepath == filepath)
+            return;
+
+    WatchedFile file = {};
+    file.filepath = filepath;
+    file.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    file.watchDescriptor = -1;
+
+    size_t separator = file.filepath.find_last_of("/\\");
+    std::string directory = separator == std::string::npos ? "." : file.filepath.substr(0, separator);
+    file.filename = separator == std::string::npos ? file.filepath : file.filepath.substr(separator + 1);
+
+#if defined(__linux__)
+    // Editors often save by writing a new file and renaming it, so the directory is watched instead of the file
+    if (GlobalInotifyFd >= 0)
+        file.watchDescriptor = inotify_add_watch(GlobalInotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+#endif
+
+    GlobalWatchedFiles.push_back(file);
+}
+
+void PollFileChanges(std::vector<std::string>& changedFiles)
+{
+    changedFiles.clear();
+
+    u32 fileIdx;
+    while (PopFileChange(fileIdx))
+    {
+        std::lock_guard<std::mutex> lock(GlobalWatchedFilesMutex);
+        const std::string& filepath = GlobalWatchedFiles[fileIdx].filepath;
+
+        if (std::find(changedFiles.begin(), changedFiles.end(), filepath) == changedFiles.end())
+            changedFiles.push_back(filepath);
+    }
+}
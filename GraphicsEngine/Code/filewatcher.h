@@ -0,0 +1,24 @@
+//
+// filewatcher.h: Watches files for modifications from a background thread, so hot reloads
+// don't need to check the timestamps of every file every frame. On Linux the thread waits
+// for inotify events, elsewhere it polls the last write timestamps of the watched files.
+//
+
+#pragma once
+
+#include "platform.h"
+
+void StartFileWatcher();
+
+void StopFileWatcher();
+
+/**
+ * Starts watching a file. Watching the same file several times has no effect.
+ */
+void WatchFile(const char* filepath);
+
+/**
+ * Fills changedFiles with the files modified since the last call. Every file appears
+ * once, no matter how many change events it received. Meant to be called once per frame.
+ */
+void PollFileChanges(std::vector<std::string>& changedFiles);
@@ -0,0 +1,39 @@
+#include "glext.h"
+
+#include <string.h>
+
+PFNGLBUFFERSTORAGEPROC glext_glBufferStorage = NULL;
+
+bool GLEXT_ARB_buffer_storage = false;
+bool GLEXT_ARB_pipeline_statistics_query = false;
+
+static bool IsGLVersionAtLeast(int major, int minor)
+{
+    return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+bool HasGLExtension(const char* name)
+{
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+
+    for (GLint i = 0; i < extensionCount; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+void LoadGLExtensions(GLADloadproc load)
+{
+    if (IsGLVersionAtLeast(4, 4) || HasGLExtension("GL_ARB_buffer_storage"))
+    {
+        glext_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+        GLEXT_ARB_buffer_storage = glext_glBufferStorage != NULL;
+    }
+
+    GLEXT_ARB_pipeline_statistics_query = IsGLVersionAtLeast(4, 6) || HasGLExtension("GL_ARB_pipeline_statistics_query");
+}
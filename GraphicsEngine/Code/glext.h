@@ -0,0 +1,33 @@
+//
+// glext.h: OpenGL functionality newer than the 4.3 profile glad was generated with.
+// These entry points are loaded at runtime and must only be used when the matching
+// GLEXT_* flag says the driver supports them.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT   0x0040
+#define GL_MAP_COHERENT_BIT     0x0080
+#define GL_DYNAMIC_STORAGE_BIT  0x0100
+#define GL_CLIENT_STORAGE_BIT   0x0200
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+extern PFNGLBUFFERSTORAGEPROC glext_glBufferStorage;
+#define glBufferStorage glext_glBufferStorage
+
+// GL 4.6 / ARB_pipeline_statistics_query, used through glBeginQuery so there are no new entry points
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+extern bool GLEXT_ARB_buffer_storage;
+extern bool GLEXT_ARB_pipeline_statistics_query;
+
+bool HasGLExtension(const char* name);
+
+void LoadGLExtensions(GLADloadproc load);
@@ -0,0 +1,103 @@
+#include "glstate.h"
+
+#include <string.h>
+
+// Never a valid name, so the first bind after a reset is always issued
+#define UNKNOWN_STATE 0xffffffffu
+
+static bool SkipBind(GLStateCache& cache, bool same)
+{
+    if (same)
+        cache.bindsSkipped++;
+    else
+        cache.bindsIssued++;
+
+    return same;
+}
+
+void ResetStateCache(GLStateCache& cache)
+{
+    const u32 bindsIssued = cache.bindsIssued;
+    const u32 bindsSkipped = cache.bindsSkipped;
+
+    memset(&cache, 0xff, sizeof(cache));
+
+    cache.bindsIssued = bindsIssued;
+    cache.bindsSkipped = bindsSkipped;
+}
+
+void CachedUseProgram(GLStateCache& cache, GLuint program)
+{
+    if (SkipBind(cache, cache.program == program))
+        return;
+
+    glUseProgram(program);
+    cache.program = program;
+}
+
+void CachedBindVertexArray(GLStateCache& cache, GLuint vertexArray)
+{
+    if (SkipBind(cache, cache.vertexArray == vertexArray))
+        return;
+
+    glBindVertexArray(vertexArray);
+    cache.vertexArray = vertexArray;
+
+    for (u32 i = 0; i < STATE_CACHE_VERTEX_BINDINGS; ++i)
+        cache.vertexBuffers[i] = UNKNOWN_STATE;
+    cache.elementBuffer = UNKNOWN_STATE;
+}
+
+void CachedBindVertexBuffer(GLStateCache& cache, u32 binding, GLuint buffer, u32 stride)
+{
+    ASSERT(binding < STATE_CACHE_VERTEX_BINDINGS, "Vertex binding not tracked by the state cache");
+
+    // Each buffer is always bound with the same stride, the stride of its arena
+    if (SkipBind(cache, cache.vertexBuffers[binding] == buffer))
+        return;
+
+    glBindVertexBuffer(binding, buffer, 0, stride);
+    cache.vertexBuffers[binding] = buffer;
+}
+
+void CachedBindElementBuffer(GLStateCache& cache, GLuint buffer)
+{
+    if (SkipBind(cache, cache.elementBuffer == buffer))
+        return;
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    cache.elementBuffer = buffer;
+}
+
+void CachedBindTexture(GLStateCache& cache, u32 unit, GLuint texture)
+{
+    ASSERT(unit < STATE_CACHE_TEXTURE_UNITS, "Texture unit not tracked by the state cache");
+
+    if (SkipBind(cache, cache.textures[unit] == texture))
+        return;
+
+    if (cache.activeTexture != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        cache.activeTexture = unit;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    cache.textures[unit] = texture;
+}
+
+void CachedBindBufferRange(GLStateCache& cache, GLenum target, u32 index, GLuint buffer, u32 offset, u32 size)
+{
+    ASSERT(index < STATE_CACHE_BUFFER_BINDINGS, "Buffer binding not tracked by the state cache");
+    ASSERT(target == GL_UNIFORM_BUFFER || target == GL_SHADER_STORAGE_BUFFER, "Unsupported buffer target");
+
+    BufferRangeBinding& binding = target == GL_UNIFORM_BUFFER ? cache.uniformBuffers[index] : cache.storageBuffers[index];
+
+    if (SkipBind(cache, binding.buffer == buffer && binding.offset == offset && binding.size == size))
+        return;
+
+    glBindBufferRange(target, index, buffer, offset, size);
+    binding.buffer = buffer;
+    binding.offset = offset;
+    binding.size = size;
+}
@@ -0,0 +1,33 @@
+//
+// glstate.h: Redundant state elimination. The Cached* functions only reach GL when
+// the state they set differs from the one set last through them, and count the binds
+// issued and skipped.
+//
+
+#pragma once
+
+#include "engine.h"
+
+/**
+ * Forgets the cached state, so the next bind of everything is issued. Call it when
+ * code that does not go through the cache (e.g. ImGui) may have changed the state.
+ */
+void ResetStateCache(GLStateCache& cache);
+
+void CachedUseProgram(GLStateCache& cache, GLuint program);
+
+/**
+ * The vertex buffer and element buffer bindings belong to the vao, so they are
+ * forgotten when a different vao is bound.
+ */
+void CachedBindVertexArray(GLStateCache& cache, GLuint vertexArray);
+
+void CachedBindVertexBuffer(GLStateCache& cache, u32 binding, GLuint buffer, u32 stride);
+
+void CachedBindElementBuffer(GLStateCache& cache, GLuint buffer);
+
+// Binds a GL_TEXTURE_2D, only changing the active texture unit when needed
+void CachedBindTexture(GLStateCache& cache, u32 unit, GLuint texture);
+
+// For GL_UNIFORM_BUFFER and GL_SHADER_STORAGE_BUFFER indexed bindings
+void CachedBindBufferRange(GLStateCache& cache, GLenum target, u32 index, GLuint buffer, u32 offset, u32 size);
@@ -0,0 +1,119 @@
+#include "gputimers.h"
+
+struct GpuScopeRecord
+{
+    const char* name;
+    u32         depth;
+    u64         cpuBegin;
+    u64         cpuEnd;
+};
+
+struct GpuTimerFrame
+{
+    GpuScopeRecord scopes[GPU_TIMER_MAX_SCOPES];
+    GLuint         queries[GPU_TIMER_MAX_SCOPES * 2];  // begin and end timestamp of every scope
+    u32            scopeCount;
+    u32            openScopeCount;
+    u32            frameIndex;
+    GLuint         lastQuery;   // the GPU is done with the frame once this one is available
+};
+
+// Only used by the thread that owns the GL context
+static GpuTimerFrame GlobalFrames[GPU_TIMER_FRAME_COUNT];
+static GpuTimerFrame* GlobalCurrentFrame = NULL;
+static u32 GlobalFrameIndex;
+static std::vector<GpuTimerResult> GlobalResults;
+static u32 GlobalResultsFrame;
+static i64 GlobalGpuToCpuOffset;    // ns to add to a GPU timestamp to place it in the CPU clock
+
+void InitGpuTimers()
+{
+    for (u32 i = 0; i < GPU_TIMER_FRAME_COUNT; ++i)
+        glGenQueries(GPU_TIMER_MAX_SCOPES * 2, GlobalFrames[i].queries);
+
+    // Both clocks are sampled back to back, close enough to line up the scopes in a trace
+    GLint64 gpuTimestamp = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTimestamp);
+    GlobalGpuToCpuOffset = (i64)GetTimestampNs() - gpuTimestamp;
+}
+
+static void ReadGpuTimerFrame(GpuTimerFrame& frame)
+{
+    if (frame.scopeCount == 0)
+        return;
+
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    GlobalResults.resize(frame.scopeCount);
+    GlobalResultsFrame = frame.frameIndex;
+
+    for (u32 i = 0; i < frame.scopeCount; ++i)
+    {
+        GLuint64 gpuBegin = 0, gpuEnd = 0;
+        glGetQueryObjectui64v(frame.queries[i * 2 + 0], GL_QUERY_RESULT, &gpuBegin);
+        glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &gpuEnd);
+
+        const GpuScopeRecord& scope = frame.scopes[i];
+        GlobalResults[i].name = scope.name;
+        GlobalResults[i].depth = scope.depth;
+        GlobalResults[i].cpuMs = (scope.cpuEnd - scope.cpuBegin) / 1e6f;
+        GlobalResults[i].gpuMs = (gpuEnd - gpuBegin) / 1e6f;
+
+        TraceGpuZone(scope.name, gpuBegin + GlobalGpuToCpuOffset, gpuEnd + GlobalGpuToCpuOffset);
+    }
+}
+
+void GpuTimersBeginFrame()
+{
+    GlobalCurrentFrame = &GlobalFrames[GlobalFrameIndex % GPU_TIMER_FRAME_COUNT];
+    GlobalFrameIndex++;
+
+    // Written GPU_TIMER_FRAME_COUNT frames ago, so its results should be ready
+    ReadGpuTimerFrame(*GlobalCurrentFrame);
+
+    GlobalCurrentFrame->scopeCount = 0;
+    GlobalCurrentFrame->openScopeCount = 0;
+    GlobalCurrentFrame->frameIndex = GlobalFrameIndex;
+}
+
+const std::vector<GpuTimerResult>& GetGpuTimerResults()
+{
+    return GlobalResults;
+}
+
+u32 GetGpuTimerResultsFrame()
+{
+    return GlobalResultsFrame;
+}
+
+GpuScope::GpuScope(const char* name, bool debugGroup) : cpuScope(name), scopeIdx(UINT32_MAX), debugGroup(debugGroup)
+{
+    if (debugGroup)
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, name);
+
+    GpuTimerFrame* frame = GlobalCurrentFrame;
+    if (!frame || frame->scopeCount == GPU_TIMER_MAX_SCOPES)
+        return;
+
+    scopeIdx = frame->scopeCount++;
+    frame->scopes[scopeIdx] = GpuScopeRecord{ name, frame->openScopeCount++, GetTimestampNs(), 0 };
+    glQueryCounter(frame->queries[scopeIdx * 2 + 0], GL_TIMESTAMP);
+}
+
+GpuScope::~GpuScope()
+{
+    if (scopeIdx != UINT32_MAX)
+    {
+        GpuTimerFrame* frame = GlobalCurrentFrame;
+        glQueryCounter(frame->queries[scopeIdx * 2 + 1], GL_TIMESTAMP);
+        frame->lastQuery = frame->queries[scopeIdx * 2 + 1];
+        frame->scopes[scopeIdx].cpuEnd = GetTimestampNs();
+        frame->openScopeCount--;
+    }
+
+    if (debugGroup)
+        glPopDebugGroup();
+}
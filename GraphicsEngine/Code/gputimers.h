@@ -0,0 +1,50 @@
+//
+// gputimers.h: GPU timing scopes. Each scope writes a GL_TIMESTAMP query where it
+// begins and ends, and pushes a debug group with the same name so captures in
+// RenderDoc/Nsight show the same hierarchy. Queries come from a pool with one set
+// per frame in flight, and a frame is read back when its set comes around again,
+// so reading the results never waits for the GPU.
+//
+
+#pragma once
+
+#include "engine.h"
+#include "profiler.h"
+
+#define GPU_TIMER_FRAME_COUNT 4     // frames in flight before a query set is reused
+#define GPU_TIMER_MAX_SCOPES  32    // per frame
+
+struct GpuTimerResult
+{
+    const char* name;
+    u32         depth;
+    f32         cpuMs;  // time the CPU spent issuing the scope
+    f32         gpuMs;
+};
+
+struct GpuScope
+{
+    GpuScope(const char* name, bool debugGroup);
+    ~GpuScope();
+
+    ProfileScope cpuScope;
+    u32          scopeIdx;
+    bool         debugGroup;
+};
+
+// Times the rest of the enclosing scope on the GPU (and the CPU), in a debug group when debugGroup is set
+#define GPU_SCOPE(name, debugGroup) GpuScope PROFILE_CONCAT(gpuScope, __LINE__)(name, debugGroup)
+
+void InitGpuTimers();
+
+/**
+ * Reads back the oldest frame of the pool if the GPU is done with it, and starts
+ * recording the scopes of a new frame in its queries.
+ */
+void GpuTimersBeginFrame();
+
+// Scopes of the most recent frame read back, in the order they began
+const std::vector<GpuTimerResult>& GetGpuTimerResults();
+
+// Number of the frame the results belong to, counting from 1 (0 until the first read back)
+u32 GetGpuTimerResultsFrame();
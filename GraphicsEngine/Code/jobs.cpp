@@ -0,0 +1,307 @@
+#include "jobs.h"
+#include "profiler.h"
+#include "transforms.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+struct Job
+{
+    JobFunction         function;
+    JobCounter*         counter;
+    const JobCounter*   dependency;
+};
+
+struct JobQueue
+{
+    std::mutex      mutex;
+    std::deque<Job> jobs;
+};
+
+static std::vector<std::thread> GlobalWorkers;
+static JobQueue*                GlobalQueues = NULL;
+static u32                      GlobalQueueCount = 0;
+static std::atomic<bool>        GlobalRunning{ false };
+static std::atomic<u32>         GlobalQueuedJobs{ 0 };
+static std::atomic<u32>         GlobalActiveThreadCount{ 0 };
+static std::mutex               GlobalSleepMutex;
+static std::condition_variable  GlobalSleepCondition;
+
+// Queue owned by the current thread. The main thread and any thread that is not
+// a worker use queue 0.
+static thread_local u32 LocalQueueIndex = 0;
+
+static void PushJob(u32 queueIndex, const Job& job, bool front)
+{
+    JobQueue& queue = GlobalQueues[queueIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (front)
+            queue.jobs.push_front(job);
+        else
+            queue.jobs.push_back(job);
+    }
+
+    // Taking the sleep mutex makes sure no worker is between checking for jobs and going to sleep
+    {
+        std::lock_guard<std::mutex> lock(GlobalSleepMutex);
+        GlobalQueuedJobs++;
+    }
+
+    // Inactive workers go back to sleep when woken, so the job could be left for nobody
+    if (GlobalActiveThreadCount < GlobalQueueCount)
+        GlobalSleepCondition.notify_all();
+    else
+        GlobalSleepCondition.notify_one();
+}
+
+static bool PopJob(u32 queueIndex, Job& job)
+{
+    // The owner takes the newest job (LIFO), which is usually the hottest in cache
+    JobQueue& queue = GlobalQueues[queueIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty())
+        return false;
+
+    job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    return true;
+}
+
+static bool StealJob(u32 thiefIndex, Job& job)
+{
+    // Thieves take the oldest job (FIFO), which usually represents the biggest chunk of work
+    for (u32 i = 1; i < GlobalQueueCount; ++i)
+    {
+        JobQueue& queue = GlobalQueues[(thiefIndex + i) % GlobalQueueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty())
+            continue;
+
+        job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+static bool TryRunJob(u32 queueIndex)
+{
+    Job job;
+    if (!PopJob(queueIndex, job) && !StealJob(queueIndex, job))
+        return false;
+
+    GlobalQueuedJobs--;
+
+    // Not ready yet, give the other jobs a chance to run first
+    if (job.dependency && job.dependency->value.load() != 0)
+    {
+        PushJob(queueIndex, job, true);
+        return false;
+    }
+
+    {
+        PROFILE_SCOPE("Job");
+        job.function();
+    }
+
+    if (job.counter)
+        job.counter->value--;
+
+    return true;
+}
+
+static void WorkerMain(u32 queueIndex)
+{
+    LocalQueueIndex = queueIndex;
+
+    char threadName[32];
+    snprintf(threadName, sizeof(threadName), "Worker %u", queueIndex);
+    ProfilerSetThreadName(threadName);
+
+    while (GlobalRunning)
+    {
+        // Workers past the active count sleep until SetActiveJobThreadCount wakes them up
+        const bool active = queueIndex < GlobalActiveThreadCount;
+
+        if (active && TryRunJob(queueIndex))
+            continue;
+
+        if (active && GlobalQueuedJobs > 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(GlobalSleepMutex);
+        GlobalSleepCondition.wait(lock, [queueIndex]() {
+            return (GlobalQueuedJobs > 0 && queueIndex < GlobalActiveThreadCount) || !GlobalRunning;
+        });
+    }
+}
+
+void InitJobSystem(u32 threadCount)
+{
+    ASSERT(GlobalQueueCount == 0, "The job system is already initialized");
+
+    if (threadCount == 0)
+        threadCount = glm::max(std::thread::hardware_concurrency(), 1u);
+
+    GlobalQueueCount = threadCount;
+    GlobalQueues = new JobQueue[threadCount];
+    GlobalActiveThreadCount = threadCount;
+    GlobalRunning = true;
+
+    for (u32 i = 1; i < threadCount; ++i)
+        GlobalWorkers.push_back(std::thread(WorkerMain, i));
+}
+
+void ShutdownJobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(GlobalSleepMutex);
+        GlobalRunning = false;
+    }
+    GlobalSleepCondition.notify_all();
+
+    for (u32 i = 0; i < GlobalWorkers.size(); ++i)
+        GlobalWorkers[i].join();
+    GlobalWorkers.clear();
+
+    // The workers finish the job they are running, the ones still queued run here so no counter is left waiting
+    while (GlobalQueueCount > 0 && GlobalQueuedJobs > 0)
+        TryRunJob(LocalQueueIndex);
+
+    delete[] GlobalQueues;
+    GlobalQueues = NULL;
+    GlobalQueueCount = 0;
+    GlobalActiveThreadCount = 0;
+    GlobalQueuedJobs = 0;
+}
+
+void SetActiveJobThreadCount(u32 threadCount)
+{
+    {
+        std::lock_guard<std::mutex> lock(GlobalSleepMutex);
+        GlobalActiveThreadCount = glm::clamp(threadCount, 1u, glm::max(GlobalQueueCount, 1u));
+    }
+    GlobalSleepCondition.notify_all();
+}
+
+u32 GetJobThreadCount()
+{
+    return glm::max(GlobalActiveThreadCount.load(), 1u);
+}
+
+void RunJob(const JobFunction& function, JobCounter* counter, const JobCounter* dependency)
+{
+    // Without workers there is nobody to hand the job to
+    if (GlobalQueueCount <= 1)
+    {
+        WaitForCounter(dependency);
+        function();
+        return;
+    }
+
+    if (counter)
+        counter->value++;
+
+    Job job = { function, counter, dependency };
+    PushJob(LocalQueueIndex, job, false);
+}
+
+void WaitForCounter(const JobCounter* counter)
+{
+    if (!counter)
+        return;
+
+    while (counter->value.load() != 0)
+    {
+        if (GlobalQueueCount == 0 || !TryRunJob(LocalQueueIndex))
+            std::this_thread::yield();
+    }
+}
+
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& function)
+{
+    if (count <= batchSize || GlobalActiveThreadCount <= 1)
+    {
+        function(0, count);
+        return;
+    }
+
+    JobCounter counter;
+
+    for (u32 begin = 0; begin < count; begin += batchSize)
+    {
+        u32 end = glm::min(begin + batchSize, count);
+        RunJob([&function, begin, end]() { function(begin, end); }, &counter);
+    }
+
+    WaitForCounter(&counter);
+}
+
+void RunJobSystemBenchmark()
+{
+    const u32 entityCount = 1000000;
+    const u32 computeCount = 4000000;
+    const u32 repetitions = 10;
+    const u32 outputStride = 2 * sizeof(glm::mat4);
+
+    const u32 previousThreadCount = GetJobThreadCount();
+    const u32 maxThreadCount = glm::max(GlobalQueueCount, 1u);
+    const TransformKernel kernel = GetBestTransformKernel();
+    const glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+
+    AlignedVector<glm::mat4> worldMatrices(entityCount);
+    for (u32 i = 0; i < entityCount; ++i)
+        worldMatrices[i] = glm::translate(glm::vec3((f32)(i % 100), (f32)(i / 100 % 100), -(f32)(i / 10000)));
+
+    std::vector<u8> output((u64)entityCount * outputStride);
+    std::vector<f32> results(computeCount);
+
+    // The workers stay alive (and keep their queued jobs), only the ones taking jobs change
+    f64 baseTransformMs = 0.0;
+    f64 baseComputeMs = 0.0;
+
+    for (u32 threadCount = 1; ; threadCount = glm::min(threadCount * 2, maxThreadCount))
+    {
+        SetActiveJobThreadCount(threadCount);
+
+        u64 start = GetTimestampNs();
+        for (u32 r = 0; r < repetitions; ++r)
+        {
+            ParallelFor(entityCount, 4096, [&](u32 begin, u32 end) {
+                TransformWorldViewProjection(kernel, viewProjection, worldMatrices.data() + begin, NULL, end - begin, &output[(u64)begin * outputStride], outputStride);
+            });
+        }
+        f64 transformMs = (GetTimestampNs() - start) / (1e6 * repetitions);
+
+        start = GetTimestampNs();
+        for (u32 r = 0; r < repetitions; ++r)
+        {
+            ParallelFor(computeCount, 4096, [&](u32 begin, u32 end) {
+                for (u32 i = begin; i < end; ++i)
+                    results[i] = glm::sin((f32)i) * glm::cos((f32)i * 0.5f) + glm::sqrt((f32)i);
+            });
+        }
+        f64 computeMs = (GetTimestampNs() - start) / (1e6 * repetitions);
+
+        if (threadCount == 1)
+        {
+            baseTransformMs = transformMs;
+            baseComputeMs = computeMs;
+        }
+
+        ILOG("Job system benchmark: %2u threads, transforms %8.3f ms (%.2fx), compute %8.3f ms (%.2fx)",
+             threadCount, transformMs, baseTransformMs / transformMs, computeMs, baseComputeMs / computeMs);
+
+        if (threadCount == maxThreadCount)
+            break;
+    }
+
+    SetActiveJobThreadCount(previousThreadCount);
+}
@@ -0,0 +1,66 @@
+//
+// jobs.h: Work-stealing job system. Every thread (the main thread included) owns a
+// queue of jobs: it pops the most recent jobs from its own queue and, when it runs
+// out of work, steals the oldest jobs from the queues of the other threads.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+#include <functional>
+
+/**
+ * Counts the jobs that have not finished yet. Jobs can be waited on with
+ * WaitForCounter, or used as the dependency of other jobs.
+ */
+struct JobCounter
+{
+    std::atomic<u32> value{ 0 };
+};
+
+typedef std::function<void()> JobFunction;
+
+/**
+ * Starts the worker threads. threadCount includes the calling thread, and 0 means
+ * one thread per hardware core. With a single thread, jobs run inline.
+ */
+void InitJobSystem(u32 threadCount);
+
+// Runs the jobs still queued and stops the worker threads
+void ShutdownJobSystem();
+
+/**
+ * Limits the threads taking jobs (the calling one included) without stopping the
+ * rest, which sleep until the count grows again. Queued jobs are kept.
+ */
+void SetActiveJobThreadCount(u32 threadCount);
+
+// Threads currently taking jobs
+u32 GetJobThreadCount();
+
+/**
+ * Queues a job in the queue of the calling thread. The counter (if any) is incremented
+ * now and decremented when the job finishes. The job will not start until the
+ * dependency counter (if any) reaches zero.
+ */
+void RunJob(const JobFunction& function, JobCounter* counter, const JobCounter* dependency = NULL);
+
+/**
+ * Runs other jobs while waiting, so it can be called from inside jobs.
+ */
+void WaitForCounter(const JobCounter* counter);
+
+/**
+ * Splits [0, count) into batches of batchSize elements, runs function(begin, end)
+ * for each of them in parallel, and waits for all of them to finish.
+ */
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& function);
+
+/**
+ * Measures how ParallelFor scales from 1 thread up to all the worker threads, both
+ * with a memory bound (entity transforms) and a compute bound workload. The thread
+ * count is changed with SetActiveJobThreadCount, so queued jobs are not lost.
+ */
+void RunJobSystemBenchmark();
@@ -0,0 +1,232 @@
+#include "lighting.h"
+#include "buffers.h"
+#include "glstate.h"
+#include "jobs.h"
+#include "profiler.h"
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void BuildClusterBounds(LightClusters& clusters)
+{
+    const u32 clusterCount = clusters.countX * clusters.countY * clusters.countZ;
+    clusters.boundsMin.resize(clusterCount);
+    clusters.boundsMax.resize(clusterCount);
+
+    const glm::mat4 inverseProjection = glm::inverse(clusters.projectionMatrix);
+    const f32 depthRatio = clusters.farPlane / clusters.nearPlane;
+
+    for (u32 z = 0; z < clusters.countZ; ++z)
+    {
+        // Exponential slices keep the clusters roughly cubic along the view direction
+        const f32 sliceNear = clusters.nearPlane * glm::pow(depthRatio, (f32)z / clusters.countZ);
+        const f32 sliceFar = clusters.nearPlane * glm::pow(depthRatio, (f32)(z + 1) / clusters.countZ);
+
+        for (u32 y = 0; y < clusters.countY; ++y)
+        {
+            for (u32 x = 0; x < clusters.countX; ++x)
+            {
+                vec3 boundsMin = vec3(FLT_MAX);
+                vec3 boundsMax = vec3(-FLT_MAX);
+
+                for (u32 corner = 0; corner < 4; ++corner)
+                {
+                    const f32 ndcX = -1.0f + 2.0f * (x + (corner & 1)) / clusters.countX;
+                    const f32 ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / clusters.countY;
+
+                    // Ray through the corner, scaled so its depth is 1
+                    vec4 nearPoint = inverseProjection * vec4(ndcX, ndcY, -1.0f, 1.0f);
+                    vec3 ray = vec3(nearPoint) / nearPoint.w;
+                    ray /= -ray.z;
+
+                    boundsMin = glm::min(boundsMin, glm::min(ray * sliceNear, ray * sliceFar));
+                    boundsMax = glm::max(boundsMax, glm::max(ray * sliceNear, ray * sliceFar));
+                }
+
+                const u32 clusterIdx = x + y * clusters.countX + z * clusters.countX * clusters.countY;
+                clusters.boundsMin[clusterIdx] = boundsMin;
+                clusters.boundsMax[clusterIdx] = boundsMax;
+            }
+        }
+    }
+}
+
+static bool SphereIntersectsAabb(vec3 center, f32 radius, vec3 boundsMin, vec3 boundsMax)
+{
+    const vec3 closest = glm::clamp(center, boundsMin, boundsMax);
+    const vec3 delta = closest - center;
+    return glm::dot(delta, delta) <= radius * radius;
+}
+
+void BuildLightClusters(App* app)
+{
+    PROFILE_SCOPE("BuildLightClusters");
+
+    LightClusters& clusters = app->lightClusters;
+
+    // Directional lights affect every cluster, so they are kept apart at the beginning of the list
+    clusters.lights.clear();
+    for (u32 pass = 0; pass < 2; ++pass)
+    {
+        for (u32 i = 0; i < app->lights.size() && clusters.lights.size() < MAX_LIGHTS; ++i)
+        {
+            const Light& light = app->lights[i];
+            if ((pass == 0) != (light.type == LightType_Directional))
+                continue;
+
+            GpuLight gpuLight = { light.color, (u32)light.type, light.direction, light.radius, light.position, 0.0f };
+            clusters.lights.push_back(gpuLight);
+        }
+
+        if (pass == 0)
+            clusters.directionalLightCount = clusters.lights.size();
+    }
+
+    const u32 countX = app->enableClusteredLighting ? CLUSTER_COUNT_X : 1;
+    const u32 countY = app->enableClusteredLighting ? CLUSTER_COUNT_Y : 1;
+    const u32 countZ = app->enableClusteredLighting ? CLUSTER_COUNT_Z : 1;
+
+    if (clusters.countX != countX || clusters.countY != countY || clusters.countZ != countZ ||
+        clusters.projectionMatrix != app->projectionMatrix)
+    {
+        clusters.countX = countX;
+        clusters.countY = countY;
+        clusters.countZ = countZ;
+        clusters.capacity = app->enableClusteredLighting ? MAX_LIGHTS_PER_CLUSTER : MAX_LIGHTS;
+        clusters.projectionMatrix = app->projectionMatrix;
+
+        // Recover the clip planes from the perspective matrix
+        const glm::mat4& p = app->projectionMatrix;
+        clusters.nearPlane = p[3][2] / (p[2][2] - 1.0f);
+        clusters.farPlane = p[3][2] / (p[2][2] + 1.0f);
+
+        BuildClusterBounds(clusters);
+    }
+
+    const u32 clusterCount = countX * countY * countZ;
+    const u32 sliceSize = countX * countY;
+    const u32 firstPointLight = clusters.directionalLightCount;
+    const u32 pointLightCount = clusters.lights.size() - firstPointLight;
+
+    clusters.lightCounts.assign(clusterCount, 0);
+    clusters.lightIndices.resize(clusterCount * clusters.capacity);
+
+    if (!app->enableClusteredLighting)
+    {
+        clusters.lightCounts[0] = pointLightCount;
+        for (u32 i = 0; i < pointLightCount; ++i)
+            clusters.lightIndices[i] = firstPointLight + i;
+
+        clusters.assignedLightCount = pointLightCount;
+        clusters.overflowCount = 0;
+        return;
+    }
+
+    // View space spheres of the point lights
+    std::vector<vec4> spheres(pointLightCount);
+    for (u32 i = 0; i < pointLightCount; ++i)
+    {
+        const GpuLight& light = clusters.lights[firstPointLight + i];
+        spheres[i] = vec4(vec3(app->viewMatrix * vec4(light.position, 1.0f)), light.radius);
+    }
+
+    // Every job owns whole depth slices, so the cluster lists can be written without synchronization
+    std::vector<u32> sliceOverflow(countZ, 0);
+    const f32 depthRatio = clusters.farPlane / clusters.nearPlane;
+
+    ParallelFor(countZ, 1, [&](u32 begin, u32 end) {
+        for (u32 z = begin; z < end; ++z)
+        {
+            const f32 sliceNear = clusters.nearPlane * glm::pow(depthRatio, (f32)z / countZ);
+            const f32 sliceFar = clusters.nearPlane * glm::pow(depthRatio, (f32)(z + 1) / countZ);
+
+            for (u32 i = 0; i < pointLightCount; ++i)
+            {
+                const vec3 center = vec3(spheres[i]);
+                const f32 radius = spheres[i].w;
+                const f32 depth = -center.z;
+
+                if (depth + radius < sliceNear || depth - radius > sliceFar)
+                    continue;
+
+                for (u32 clusterIdx = z * sliceSize; clusterIdx < (z + 1) * sliceSize; ++clusterIdx)
+                {
+                    if (!SphereIntersectsAabb(center, radius, clusters.boundsMin[clusterIdx], clusters.boundsMax[clusterIdx]))
+                        continue;
+
+                    u32& lightCount = clusters.lightCounts[clusterIdx];
+                    if (lightCount < clusters.capacity)
+                        clusters.lightIndices[clusterIdx * clusters.capacity + lightCount++] = firstPointLight + i;
+                    else
+                        sliceOverflow[z]++;
+                }
+            }
+        }
+    });
+
+    clusters.assignedLightCount = 0;
+    clusters.overflowCount = 0;
+    for (u32 i = 0; i < clusterCount; ++i)
+        clusters.assignedLightCount += clusters.lightCounts[i];
+    for (u32 z = 0; z < countZ; ++z)
+        clusters.overflowCount += sliceOverflow[z];
+}
+
+void UploadLightClusters(App* app)
+{
+    PROFILE_SCOPE("UploadLightClusters");
+
+    const LightClusters& clusters = app->lightClusters;
+    const u32 clusterCount = clusters.countX * clusters.countY * clusters.countZ;
+
+    MapBufferRegion(app->lightBuffer);
+
+    // Bound ranges can't be empty, so there is always room for at least one element
+    app->lightsSize = glm::max(clusters.lights.size(), (size_t)1) * sizeof(GpuLight);
+    GpuLight* lights = (GpuLight*)ReserveAlignedData(app->lightBuffer, app->lightsSize, app->storageBufferAlignment);
+    app->lightsOffset = app->lightBuffer.head - app->lightsSize;
+    memcpy(lights, clusters.lights.data(), clusters.lights.size() * sizeof(GpuLight));
+
+    // Offset and count of the light list of every cluster
+    app->clusterRangesSize = clusterCount * sizeof(glm::uvec2);
+    glm::uvec2* ranges = (glm::uvec2*)ReserveAlignedData(app->lightBuffer, app->clusterRangesSize, app->storageBufferAlignment);
+    app->clusterRangesOffset = app->lightBuffer.head - app->clusterRangesSize;
+
+    app->clusterLightsSize = glm::max(clusters.assignedLightCount, 1u) * sizeof(u32);
+    u32* clusterLights = (u32*)ReserveAlignedData(app->lightBuffer, app->clusterLightsSize, app->storageBufferAlignment);
+    app->clusterLightsOffset = app->lightBuffer.head - app->clusterLightsSize;
+
+    u32 offset = 0;
+    for (u32 i = 0; i < clusterCount; ++i)
+    {
+        ranges[i] = glm::uvec2(offset, clusters.lightCounts[i]);
+        memcpy(clusterLights + offset, &clusters.lightIndices[i * clusters.capacity], clusters.lightCounts[i] * sizeof(u32));
+        offset += clusters.lightCounts[i];
+    }
+
+    UnmapBufferRegion(app->lightBuffer);
+}
+
+void BindLightClusters(App* app)
+{
+    CachedBindBufferRange(app->glState, GL_SHADER_STORAGE_BUFFER, BINDING(3), app->lightBuffer.handle, app->lightsOffset, app->lightsSize);
+    CachedBindBufferRange(app->glState, GL_SHADER_STORAGE_BUFFER, BINDING(4), app->lightBuffer.handle, app->clusterRangesOffset, app->clusterRangesSize);
+    CachedBindBufferRange(app->glState, GL_SHADER_STORAGE_BUFFER, BINDING(5), app->lightBuffer.handle, app->clusterLightsOffset, app->clusterLightsSize);
+}
+
+void AddRandomPointLights(App* app, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        const f32 u = (f32)rand() / RAND_MAX;
+        const f32 v = (f32)rand() / RAND_MAX;
+        const f32 w = (f32)rand() / RAND_MAX;
+
+        vec3 color = glm::normalize(vec3((f32)rand() / RAND_MAX, (f32)rand() / RAND_MAX, (f32)rand() / RAND_MAX) + vec3(0.1f));
+        vec3 position = vec3(-10.0f + 20.0f * u, 4.0f * v, -12.0f + 16.0f * w);
+        f32 radius = 1.0f + 2.0f * (f32)rand() / RAND_MAX;
+
+        app->lights.push_back(Light(LightType_Point, color, vec3(0.0f), position, radius));
+    }
+}
@@ -0,0 +1,37 @@
+//
+// lighting.h: Clustered forward lighting. The view frustum is split into a grid of
+// clusters (froxels) with exponential depth slices, the lights are assigned to the
+// clusters they touch every frame, and each fragment only shades the lights of the
+// cluster it falls in.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+#define CLUSTER_COUNT   (CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z)
+
+#define MAX_LIGHTS             4096
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+// Size of each frame region of the light buffer: lights, cluster ranges and cluster light indices
+#define LIGHT_REGION_SIZE MB(4)
+
+/**
+ * Assigns the lights to the clusters of the current camera. With clustered lighting
+ * disabled, a single cluster holds every light (brute force forward lighting).
+ */
+void BuildLightClusters(App* app);
+
+/**
+ * Writes the lights and the cluster light lists into the light buffer, and stores
+ * the ranges to bind in app.
+ */
+void UploadLightClusters(App* app);
+
+void BindLightClusters(App* app);
+
+void AddRandomPointLights(App* app, u32 count);
@@ -0,0 +1,372 @@
+#include "lod.h"
+#include "jobs.h"
+#include "meshoptimization.h"
+#include "profiler.h"
+
+#include <float.h>
+#include <algorithm>
+#include <unordered_map>
+
+#define LOD_BATCH_SIZE 1024
+
+// Collapses turning a triangle more than ~78 degrees away from its normal are rejected
+#define LOD_MIN_NORMAL_COS 0.2
+
+// Sum of the squared distances to a set of planes, stored as the symmetric 4x4 matrix of Garland and Heckbert
+struct Quadric
+{
+    f64 a2, ab, ac, ad;
+    f64     b2, bc, bd;
+    f64         c2, cd;
+    f64             d2;
+};
+
+static void AddPlane(Quadric& q, glm::dvec3 n, f64 d, f64 weight)
+{
+    q.a2 += weight * n.x * n.x; q.ab += weight * n.x * n.y; q.ac += weight * n.x * n.z; q.ad += weight * n.x * d;
+    q.b2 += weight * n.y * n.y; q.bc += weight * n.y * n.z; q.bd += weight * n.y * d;
+    q.c2 += weight * n.z * n.z; q.cd += weight * n.z * d;
+    q.d2 += weight * d * d;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& other)
+{
+    q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+    q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+    q.c2 += other.c2; q.cd += other.cd;
+    q.d2 += other.d2;
+}
+
+static f64 QuadricError(const Quadric& q, glm::dvec3 p)
+{
+    return q.a2 * p.x * p.x + 2.0 * q.ab * p.x * p.y + 2.0 * q.ac * p.x * p.z + 2.0 * q.ad * p.x
+         + q.b2 * p.y * p.y + 2.0 * q.bc * p.y * p.z + 2.0 * q.bd * p.y
+         + q.c2 * p.z * p.z + 2.0 * q.cd * p.z
+         + q.d2;
+}
+
+struct Collapse
+{
+    f64 cost;
+    u32 from;
+    u32 to;
+};
+
+static glm::dvec3 ReadPosition(const f32* vertices, u32 strideInFloats, u32 vertex)
+{
+    const f32* p = vertices + vertex * strideInFloats;
+    return glm::dvec3(p[0], p[1], p[2]);
+}
+
+void SimplifyIndices(const u32* indices, u32 indexCount, const f32* vertices, u32 strideInFloats, u32 vertexCount,
+                     u32 targetIndexCount, std::vector<u32>& result)
+{
+    std::vector<glm::dvec3> positions(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        positions[v] = ReadPosition(vertices, strideInFloats, v);
+
+    // Vertices sharing a position are split by an attribute seam (normals, texture coordinates...).
+    // They are welded to the first of them to find the topology, and never moved
+    std::vector<u32> sorted(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        sorted[v] = v;
+
+    std::sort(sorted.begin(), sorted.end(), [&](u32 a, u32 b) {
+        const glm::dvec3& pa = positions[a];
+        const glm::dvec3& pb = positions[b];
+        return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z != pb.z ? pa.z < pb.z : a < b;
+    });
+
+    std::vector<u32> welded(vertexCount);
+    std::vector<u8> locked(vertexCount, 0);
+    for (u32 i = 0; i < vertexCount; )
+    {
+        u32 end = i + 1;
+        while (end < vertexCount && positions[sorted[end]] == positions[sorted[i]])
+            end++;
+
+        for (u32 j = i; j < end; ++j)
+        {
+            welded[sorted[j]] = sorted[i];
+            locked[sorted[j]] = end - i > 1;
+        }
+        i = end;
+    }
+
+    // Open borders (edges with a single triangle) and non manifold edges keep their vertices too,
+    // otherwise the silhouette would shrink and holes would open
+    std::unordered_map<u64, u32> edgeTriangles;
+    for (u32 i = 0; i < indexCount; i += 3)
+    {
+        for (u32 e = 0; e < 3; ++e)
+        {
+            const u32 a = welded[indices[i + e]];
+            const u32 b = welded[indices[i + (e + 1) % 3]];
+            if (a != b)
+                edgeTriangles[(u64)glm::min(a, b) << 32 | glm::max(a, b)]++;
+        }
+    }
+
+    std::vector<u8> weldedLocked(vertexCount, 0);
+    for (auto it = edgeTriangles.begin(); it != edgeTriangles.end(); ++it)
+    {
+        if (it->second != 2)
+        {
+            weldedLocked[it->first >> 32] = 1;
+            weldedLocked[it->first & 0xFFFFFFFF] = 1;
+        }
+    }
+
+    for (u32 v = 0; v < vertexCount; ++v)
+        locked[v] |= weldedLocked[welded[v]];
+
+    // Planes of the triangles around every (welded) vertex, weighted by their area
+    std::vector<Quadric> quadrics(vertexCount, Quadric{});
+    for (u32 i = 0; i < indexCount; i += 3)
+    {
+        const glm::dvec3 p0 = positions[indices[i + 0]];
+        const glm::dvec3 p1 = positions[indices[i + 1]];
+        const glm::dvec3 p2 = positions[indices[i + 2]];
+        const glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        const f64 length = glm::length(normal);
+        if (length == 0.0)
+            continue;
+
+        const glm::dvec3 n = normal / length;
+        const f64 d = -glm::dot(n, p0);
+        for (u32 c = 0; c < 3; ++c)
+            AddPlane(quadrics[welded[indices[i + c]]], n, d, length * 0.5);
+    }
+
+    // Each pass collapses the cheapest edges whose neighbourhoods don't overlap, so the
+    // triangle adjacency stays valid during the pass and is rebuilt for the next one
+    result.assign(indices, indices + indexCount);
+
+    std::vector<u32> adjacencyOffsets(vertexCount + 1);
+    std::vector<u32> adjacency;
+    std::vector<u32> remap(vertexCount);
+    std::vector<u8> touched(vertexCount);
+    std::vector<Collapse> collapses;
+
+    while (result.size() > targetIndexCount)
+    {
+        const u32 triangleCount = result.size() / 3;
+
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (u32 i = 0; i < result.size(); ++i)
+            adjacencyOffsets[result[i] + 1]++;
+        for (u32 v = 0; v < vertexCount; ++v)
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+        adjacency.resize(result.size());
+        std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (u32 i = 0; i < result.size(); ++i)
+            adjacency[fill[result[i]]++] = i / 3;
+
+        collapses.clear();
+        for (u32 i = 0; i < result.size(); i += 3)
+        {
+            for (u32 e = 0; e < 3; ++e)
+            {
+                const u32 a = result[i + e];
+                const u32 b = result[i + (e + 1) % 3];
+                if (!locked[a])
+                {
+                    Quadric q = quadrics[a];
+                    AddQuadric(q, quadrics[welded[b]]);
+                    collapses.push_back(Collapse{ QuadricError(q, positions[b]), a, b });
+                }
+                if (!locked[b])
+                {
+                    Quadric q = quadrics[b];
+                    AddQuadric(q, quadrics[welded[a]]);
+                    collapses.push_back(Collapse{ QuadricError(q, positions[a]), b, a });
+                }
+            }
+        }
+
+        if (collapses.empty())
+            break;
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        for (u32 v = 0; v < vertexCount; ++v)
+            remap[v] = v;
+        std::fill(touched.begin(), touched.end(), 0);
+
+        const u32 targetTriangleCount = targetIndexCount / 3;
+        u32 remainingTriangles = triangleCount;
+        u32 collapseCount = 0;
+
+        for (u32 c = 0; c < collapses.size() && remainingTriangles > targetTriangleCount; ++c)
+        {
+            const u32 from = collapses[c].from;
+            const u32 to = collapses[c].to;
+            if (touched[from] || touched[to])
+                continue;
+
+            // Moving the vertex must not flip (or squash) any of the triangles that survive
+            bool flips = false;
+            u32 removedTriangles = 0;
+            for (u32 j = adjacencyOffsets[from]; j < adjacencyOffsets[from + 1] && !flips; ++j)
+            {
+                const u32* triangle = &result[adjacency[j] * 3];
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+                {
+                    removedTriangles++;
+                    continue;
+                }
+
+                glm::dvec3 p[3], q[3];
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    p[k] = positions[triangle[k]];
+                    q[k] = triangle[k] == from ? positions[to] : p[k];
+                }
+
+                const glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                const glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips = glm::dot(before, after) <= LOD_MIN_NORMAL_COS * glm::length(before) * glm::length(after);
+            }
+
+            if (flips)
+                continue;
+
+            remap[from] = to;
+            AddQuadric(quadrics[welded[to]], quadrics[from]);
+            remainingTriangles -= removedTriangles;
+            collapseCount++;
+
+            for (u32 j = adjacencyOffsets[from]; j < adjacencyOffsets[from + 1]; ++j)
+                for (u32 k = 0; k < 3; ++k)
+                    touched[result[adjacency[j] * 3 + k]] = 1;
+        }
+
+        if (collapseCount == 0)
+            break;
+
+        // Sources are never targets in the same pass, so a single remap is enough
+        u32 writeIdx = 0;
+        for (u32 i = 0; i < result.size(); i += 3)
+        {
+            const u32 a = remap[result[i + 0]];
+            const u32 b = remap[result[i + 1]];
+            const u32 c = remap[result[i + 2]];
+            if (a == b || b == c || c == a)
+                continue;
+
+            result[writeIdx++] = a;
+            result[writeIdx++] = b;
+            result[writeIdx++] = c;
+        }
+        result.resize(writeIdx);
+    }
+}
+
+void GenerateSubmeshLods(Submesh& submesh)
+{
+    PROFILE_SCOPE("GenerateSubmeshLods");
+
+    const u32 strideInFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+    const u32 vertexCount = submesh.vertices.size() / strideInFloats;
+    const u32 fullIndexCount = submesh.indices.size();
+
+    submesh.lods.clear();
+    submesh.lods.push_back(SubmeshLod{ 0, fullIndexCount });
+
+    // Every level is simplified from the previous one, so the error doesn't start over each time
+    std::vector<u32> previous(submesh.indices);
+    std::vector<u32> simplified;
+
+    for (u32 lod = 1; lod < MAX_LODS; ++lod)
+    {
+        const u32 targetIndexCount = (fullIndexCount / 3 >> lod) * 3;
+        if (targetIndexCount < LOD_MIN_TRIANGLES * 3)
+            break;
+
+        SimplifyIndices(previous.data(), previous.size(), submesh.vertices.data(), strideInFloats, vertexCount, targetIndexCount, simplified);
+        if (simplified.size() > previous.size() * LOD_MIN_REDUCTION)
+            break;
+
+        OptimizeVertexCache(simplified.data(), simplified.size(), vertexCount);
+
+        submesh.lods.push_back(SubmeshLod{ (u32)submesh.indices.size(), (u32)simplified.size() });
+        submesh.indices.insert(submesh.indices.end(), simplified.begin(), simplified.end());
+        previous.swap(simplified);
+    }
+}
+
+// Projected radius below which an entity switches to the given level (1 or more)
+static f32 LodThreshold(u32 lod)
+{
+    return LOD_SCREEN_SIZE / (f32)(1u << (lod - 1));
+}
+
+void SelectEntityLods(App* app)
+{
+    PROFILE_SCOPE("SelectEntityLods");
+
+    // Levels of every mesh, and the triangles drawn with each of them
+    std::vector<u32> meshLodCounts(app->meshes.size(), 1);
+    std::vector<u32> meshLodTriangles(app->meshes.size() * MAX_LODS, 0);
+    for (u32 i = 0; i < app->meshes.size(); ++i)
+    {
+        const Mesh& mesh = app->meshes[i];
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        {
+            const Submesh& submesh = mesh.submeshes[j];
+            meshLodCounts[i] = glm::max(meshLodCounts[i], (u32)submesh.lods.size());
+            for (u32 lod = 0; lod < MAX_LODS; ++lod)
+                meshLodTriangles[i * MAX_LODS + lod] += GetSubmeshLod(submesh, lod).indexCount / 3;
+        }
+    }
+
+    // cot(fov / 2), so the radius over the distance becomes a fraction of half the viewport height
+    const f32 projectionScale = app->projectionMatrix[1][1];
+
+    ParallelFor(app->visibleEntities.size(), LOD_BATCH_SIZE, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; ++i)
+        {
+            const u32 entityIdx = app->visibleEntities[i];
+            Entity& entity = app->entities[entityIdx];
+            const u32 meshIdx = app->models[entity.modelIndex].meshIdx;
+            const u32 lodCount = meshLodCounts[meshIdx];
+
+            if (!app->enableLods || lodCount == 1)
+            {
+                entity.lod = 0;
+                continue;
+            }
+
+            const BoundingVolume& bounds = app->meshes[meshIdx].bounds;
+            const glm::mat4& world = app->worldMatrices[entityIdx];
+            const vec3 center = vec3(world * vec4(bounds.sphereCenter, 1.0f));
+            const f32 scale = glm::sqrt(glm::max(glm::max(glm::dot(world[0], world[0]), glm::dot(world[1], world[1])), glm::dot(world[2], world[2])));
+            const f32 radius = bounds.sphereRadius * scale;
+            const f32 distance = glm::distance(center, app->cameraPosition);
+            const f32 screenSize = distance > radius ? radius * projectionScale / distance : FLT_MAX;
+
+            // Switching only once past the threshold by a margin, in either direction
+            u32 lod = glm::min(entity.lod, lodCount - 1);
+            while (lod + 1 < lodCount && screenSize < LodThreshold(lod + 1) * (1.0f - LOD_HYSTERESIS))
+                lod++;
+            while (lod > 0 && screenSize > LodThreshold(lod) * (1.0f + LOD_HYSTERESIS))
+                lod--;
+
+            entity.lod = lod;
+        }
+    });
+
+    app->triangleCount = 0;
+    app->fullDetailTriangleCount = 0;
+    memset(app->lodEntityCounts, 0, sizeof(app->lodEntityCounts));
+
+    for (u32 i = 0; i < app->visibleEntities.size(); ++i)
+    {
+        const Entity& entity = app->entities[app->visibleEntities[i]];
+        const u32 meshIdx = app->models[entity.modelIndex].meshIdx;
+        app->triangleCount += meshLodTriangles[meshIdx * MAX_LODS + entity.lod];
+        app->fullDetailTriangleCount += meshLodTriangles[meshIdx * MAX_LODS];
+        app->lodEntityCounts[entity.lod]++;
+    }
+}
@@ -0,0 +1,41 @@
+//
+// lod.h: Levels of detail. Every submesh is simplified at load time with quadric error
+// metrics (Garland and Heckbert), collapsing edges onto one of their vertices so all
+// the levels share the vertices of the full mesh and only add index ranges. Each frame
+// the entities pick a level from the size of their bounding sphere on screen.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define LOD_MIN_TRIANGLES  64       // levels below this are not worth a draw of their own
+#define LOD_MIN_REDUCTION  0.85f    // a level must have at most this ratio of the triangles of the previous one
+#define LOD_SCREEN_SIZE    0.5f     // projected radius (fraction of half the viewport height) below which LOD 1 is used,
+                                    // halved for every following level
+#define LOD_HYSTERESIS     0.15f    // margin around each threshold before switching level, so entities don't flicker
+
+inline const SubmeshLod& GetSubmeshLod(const Submesh& submesh, u32 lod)
+{
+    return submesh.lods[glm::min(lod, (u32)submesh.lods.size() - 1)];
+}
+
+/**
+ * Simplifies indices (whose first 3 floats of every vertex are the position) until
+ * at most targetIndexCount remain or no edge can be collapsed anymore. Vertices on
+ * borders and on attribute seams are kept in place.
+ */
+void SimplifyIndices(const u32* indices, u32 indexCount, const f32* vertices, u32 strideInFloats, u32 vertexCount,
+                     u32 targetIndexCount, std::vector<u32>& result);
+
+/**
+ * Appends up to MAX_LODS - 1 simplified levels, each with about half the triangles of
+ * the previous one, to the indices of a submesh with float vertices and fills its lods.
+ */
+void GenerateSubmeshLods(Submesh& submesh);
+
+/**
+ * Chooses the level of detail of every visible entity, and counts the triangles
+ * drawn by them for the stats.
+ */
+void SelectEntityLods(App* app);
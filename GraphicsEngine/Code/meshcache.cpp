@@ -0,0 +1,324 @@
+#include "meshcache.h"
+#include "culling.h"
+#include "vertexcompression.h"
+
+#include <string.h>
+
+static u64 AlignOffset(u64 offset, u64 alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static void CopyTexturePath(App* app, u32 textureIdx, char* path)
+{
+    // Materials without a texture keep index 0 (the white placeholder), so any index is saved by path
+    const char* filepath = textureIdx < app->textures.size() ? app->textures[textureIdx].filepath.c_str() : "";
+    strncpy(path, filepath, MESH_CACHE_MAX_PATH - 1);
+}
+
+static u32 LoadTexturePath(App* app, const char* path)
+{
+    return path[0] ? LoadTexture2D(app, path) : 0;
+}
+
+static bool IsRangeInFile(u64 offset, u64 size, u64 fileSize)
+{
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+static bool IsTerminated(const char* string)
+{
+    return memchr(string, 0, MESH_CACHE_MAX_PATH) != NULL;
+}
+
+/**
+ * Checks that every table, blob range, count and string of a cache file lies inside
+ * the file, so a truncated or corrupted file is rejected instead of read out of bounds.
+ */
+static bool ValidateModelCache(const u8* data, u64 fileSize)
+{
+    const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+
+    if (!IsRangeInFile(header->submeshesOffset, (u64)header->submeshCount * sizeof(MeshCacheSubmesh), fileSize) ||
+        !IsRangeInFile(header->materialsOffset, (u64)header->materialCount * sizeof(MeshCacheMaterial), fileSize) ||
+        !IsRangeInFile(header->verticesOffset, 0, fileSize) ||
+        !IsRangeInFile(header->indicesOffset, 0, fileSize) ||
+        header->submeshesOffset % 16 != 0 || header->materialsOffset % 16 != 0 ||
+        header->verticesOffset % 16 != 0 || header->indicesOffset % 16 != 0)
+        return false;
+
+    const MeshCacheSubmesh* cachedSubmeshes = (const MeshCacheSubmesh*)(data + header->submeshesOffset);
+    for (u32 i = 0; i < header->submeshCount; ++i)
+    {
+        const MeshCacheSubmesh& cachedSubmesh = cachedSubmeshes[i];
+        const u64 indexSize = cachedSubmesh.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+
+        if (cachedSubmesh.materialIndex >= header->materialCount ||
+            cachedSubmesh.stride == 0 || cachedSubmesh.stride % sizeof(float) != 0 ||
+            (cachedSubmesh.indexType != GL_UNSIGNED_SHORT && cachedSubmesh.indexType != GL_UNSIGNED_INT) ||
+            cachedSubmesh.attributeCount > MESH_CACHE_MAX_ATTRIBUTES ||
+            cachedSubmesh.lodCount > MAX_LODS ||
+            cachedSubmesh.verticesOffset % sizeof(float) != 0 || cachedSubmesh.indicesOffset % indexSize != 0 ||
+            !IsRangeInFile(cachedSubmesh.verticesOffset, (u64)cachedSubmesh.vertexCount * cachedSubmesh.stride, fileSize - header->verticesOffset) ||
+            !IsRangeInFile(cachedSubmesh.indicesOffset, cachedSubmesh.indexCount * indexSize, fileSize - header->indicesOffset))
+            return false;
+
+        for (u32 j = 0; j < cachedSubmesh.attributeCount; ++j)
+            if (cachedSubmesh.attributes[j].offset >= cachedSubmesh.stride)
+                return false;
+
+        for (u32 j = 0; j < cachedSubmesh.lodCount; ++j)
+            if (!IsRangeInFile(cachedSubmesh.lods[j].firstIndex, cachedSubmesh.lods[j].indexCount, cachedSubmesh.indexCount))
+                return false;
+
+        // The levels of detail are rebuilt on the CPU from these, so they must point at real vertices
+        const u8* indices = data + header->indicesOffset + cachedSubmesh.indicesOffset;
+        for (u32 j = 0; j < cachedSubmesh.indexCount; ++j)
+        {
+            const u32 index = indexSize == sizeof(u16) ? ((const u16*)indices)[j] : ((const u32*)indices)[j];
+            if (index >= cachedSubmesh.vertexCount)
+                return false;
+        }
+    }
+
+    const MeshCacheMaterial* cachedMaterials = (const MeshCacheMaterial*)(data + header->materialsOffset);
+    for (u32 i = 0; i < header->materialCount; ++i)
+    {
+        const MeshCacheMaterial& material = cachedMaterials[i];
+        if (!IsTerminated(material.name) || !IsTerminated(material.albedoTexture) || !IsTerminated(material.emissiveTexture) ||
+            !IsTerminated(material.specularTexture) || !IsTerminated(material.normalsTexture) || !IsTerminated(material.bumpTexture))
+            return false;
+    }
+
+    return true;
+}
+
+u32 LoadModelCache(App* app, const char* filename, const char* cachePath)
+{
+    MappedFile file = MapFile(cachePath);
+    if (!file.data)
+        return UINT32_MAX;
+
+    const u8* data = (const u8*)file.data;
+    const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+
+    if (file.size < sizeof(MeshCacheHeader) ||
+        header->magic != MESH_CACHE_MAGIC ||
+        header->version != MESH_CACHE_VERSION ||
+        header->vertexCompression != VERTEX_COMPRESSION ||
+        header->sourceTimestamp != GetFileLastWriteTimestamp(filename) ||
+        header->sourceSize != GetFileSize(filename) ||
+        !(header->positionScale > 0.0f))
+    {
+        UnmapFile(file);
+        return UINT32_MAX;
+    }
+
+    if (!ValidateModelCache(data, file.size))
+    {
+        ELOG("Ignoring the corrupted mesh cache %s", cachePath);
+        UnmapFile(file);
+        return UINT32_MAX;
+    }
+
+    const MeshCacheSubmesh* cachedSubmeshes = (const MeshCacheSubmesh*)(data + header->submeshesOffset);
+    const MeshCacheMaterial* cachedMaterials = (const MeshCacheMaterial*)(data + header->materialsOffset);
+
+    app->meshes.push_back(Mesh{});
+    Mesh& mesh = app->meshes.back();
+    mesh.name = filename;
+    mesh.bounds = header->bounds;
+    mesh.positionOffset = header->positionOffset;
+    mesh.positionScale = header->positionScale;
+    u32 meshIdx = (u32)app->meshes.size() - 1u;
+
+    app->models.push_back(Model{});
+    Model& model = app->models.back();
+    model.meshIdx = meshIdx;
+    u32 modelIdx = (u32)app->models.size() - 1u;
+
+    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    for (u32 i = 0; i < header->materialCount; ++i)
+    {
+        const MeshCacheMaterial& cachedMaterial = cachedMaterials[i];
+
+        Material material = {};
+        material.name = cachedMaterial.name;
+        material.albedo = cachedMaterial.albedo;
+        material.emissive = cachedMaterial.emissive;
+        material.smoothness = cachedMaterial.smoothness;
+        material.specular = cachedMaterial.specular;
+        material.albedoTextureIdx = LoadTexturePath(app, cachedMaterial.albedoTexture);
+        material.emissiveTextureIdx = LoadTexturePath(app, cachedMaterial.emissiveTexture);
+        material.specularTextureIdx = LoadTexturePath(app, cachedMaterial.specularTexture);
+        material.normalsTextureIdx = LoadTexturePath(app, cachedMaterial.normalsTexture);
+        material.bumpTextureIdx = LoadTexturePath(app, cachedMaterial.bumpTexture);
+        app->materials.push_back(material);
+    }
+
+    mesh.submeshes.resize(header->submeshCount);
+    for (u32 i = 0; i < header->submeshCount; ++i)
+    {
+        const MeshCacheSubmesh& cachedSubmesh = cachedSubmeshes[i];
+        const float* vertices = (const float*)(data + header->verticesOffset + cachedSubmesh.verticesOffset);
+        const u8* indices = data + header->indicesOffset + cachedSubmesh.indicesOffset;
+
+        Submesh& submesh = mesh.submeshes[i];
+        submesh.vertexBufferLayout.stride = cachedSubmesh.stride;
+        submesh.vertexBufferLayout.attributes.assign(cachedSubmesh.attributes, cachedSubmesh.attributes + cachedSubmesh.attributeCount);
+        submesh.vertices.assign(vertices, vertices + cachedSubmesh.vertexCount * cachedSubmesh.stride / sizeof(float));
+        submesh.indexType = cachedSubmesh.indexType;
+        if (submesh.indexType == GL_UNSIGNED_SHORT)
+            submesh.indices.assign((const u16*)indices, (const u16*)indices + cachedSubmesh.indexCount);
+        else
+            submesh.indices.assign((const u32*)indices, (const u32*)indices + cachedSubmesh.indexCount);
+        submesh.bounds = cachedSubmesh.bounds;
+        submesh.lods.assign(cachedSubmesh.lods, cachedSubmesh.lods + cachedSubmesh.lodCount);
+
+        model.materialIdx.push_back(baseMeshMaterialIndex + cachedSubmesh.materialIndex);
+
+        AddSubmeshToArena(app, submesh);
+    }
+
+    UnmapFile(file);
+    return modelIdx;
+}
+
+void SaveModelCache(App* app, const char* filename, const char* cachePath, u32 modelIdx)
+{
+    const Model& model = app->models[modelIdx];
+    const Mesh& mesh = app->meshes[model.meshIdx];
+
+    // The materials of a model are contiguous, starting from the lowest index used by its submeshes
+    u32 baseMeshMaterialIndex = UINT32_MAX;
+    u32 endMeshMaterialIndex = 0;
+    for (u32 i = 0; i < model.materialIdx.size(); ++i)
+    {
+        baseMeshMaterialIndex = glm::min(baseMeshMaterialIndex, model.materialIdx[i]);
+        endMeshMaterialIndex = glm::max(endMeshMaterialIndex, model.materialIdx[i] + 1);
+    }
+    if (model.materialIdx.empty())
+        baseMeshMaterialIndex = endMeshMaterialIndex = 0;
+
+    MeshCacheHeader header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.vertexCompression = VERTEX_COMPRESSION;
+    header.sourceTimestamp = GetFileLastWriteTimestamp(filename);
+    header.sourceSize = GetFileSize(filename);
+    header.submeshCount = mesh.submeshes.size();
+    header.materialCount = endMeshMaterialIndex - baseMeshMaterialIndex;
+    header.bounds = mesh.bounds;
+    header.positionOffset = mesh.positionOffset;
+    header.positionScale = mesh.positionScale;
+
+    std::vector<MeshCacheSubmesh> cachedSubmeshes(header.submeshCount);
+    u64 verticesSize = 0;
+    u64 indicesSize = 0;
+
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        ASSERT(submesh.vertexBufferLayout.attributes.size() <= MESH_CACHE_MAX_ATTRIBUTES, "Too many vertex attributes for the mesh cache");
+        ASSERT(submesh.lods.size() <= MAX_LODS, "Too many levels of detail for the mesh cache");
+        ASSERT(submesh.indices.size() == submesh.indexCount, "The CPU copies must be kept until the cache is written");
+
+        MeshCacheSubmesh& cachedSubmesh = cachedSubmeshes[i];
+        memset(&cachedSubmesh, 0, sizeof(cachedSubmesh));
+        cachedSubmesh.materialIndex = model.materialIdx[i] - baseMeshMaterialIndex;
+        cachedSubmesh.stride = submesh.vertexBufferLayout.stride;
+        cachedSubmesh.vertexCount = submesh.vertices.size() * sizeof(float) / cachedSubmesh.stride;
+        cachedSubmesh.indexCount = submesh.indices.size();
+        cachedSubmesh.indexType = submesh.indexType;
+        cachedSubmesh.verticesOffset = verticesSize;
+        cachedSubmesh.indicesOffset = indicesSize;
+        cachedSubmesh.attributeCount = submesh.vertexBufferLayout.attributes.size();
+        for (u32 j = 0; j < cachedSubmesh.attributeCount; ++j)
+            cachedSubmesh.attributes[j] = submesh.vertexBufferLayout.attributes[j];
+        cachedSubmesh.bounds = submesh.bounds;
+        cachedSubmesh.lodCount = submesh.lods.size();
+        for (u32 j = 0; j < cachedSubmesh.lodCount; ++j)
+            cachedSubmesh.lods[j] = submesh.lods[j];
+
+        verticesSize += submesh.vertices.size() * sizeof(float);
+        indicesSize += AlignOffset(submesh.indices.size() * GetIndexTypeSize(submesh.indexType), sizeof(u32));
+    }
+
+    std::vector<MeshCacheMaterial> cachedMaterials(header.materialCount);
+    for (u32 i = 0; i < header.materialCount; ++i)
+    {
+        const Material& material = app->materials[baseMeshMaterialIndex + i];
+
+        MeshCacheMaterial& cachedMaterial = cachedMaterials[i];
+        memset(&cachedMaterial, 0, sizeof(cachedMaterial));
+        strncpy(cachedMaterial.name, material.name.c_str(), MESH_CACHE_MAX_PATH - 1);
+        cachedMaterial.albedo = material.albedo;
+        cachedMaterial.emissive = material.emissive;
+        cachedMaterial.smoothness = material.smoothness;
+        cachedMaterial.specular = material.specular;
+        CopyTexturePath(app, material.albedoTextureIdx, cachedMaterial.albedoTexture);
+        CopyTexturePath(app, material.emissiveTextureIdx, cachedMaterial.emissiveTexture);
+        CopyTexturePath(app, material.specularTextureIdx, cachedMaterial.specularTexture);
+        CopyTexturePath(app, material.normalsTextureIdx, cachedMaterial.normalsTexture);
+        CopyTexturePath(app, material.bumpTextureIdx, cachedMaterial.bumpTexture);
+    }
+
+    // Blobs are 16 byte aligned so they can be read in place from the mapping
+    header.submeshesOffset = AlignOffset(sizeof(MeshCacheHeader), 16);
+    header.materialsOffset = AlignOffset(header.submeshesOffset + header.submeshCount * sizeof(MeshCacheSubmesh), 16);
+    header.verticesOffset = AlignOffset(header.materialsOffset + header.materialCount * sizeof(MeshCacheMaterial), 16);
+    header.indicesOffset = AlignOffset(header.verticesOffset + verticesSize, 16);
+
+    // Written under a temporary name and moved into place, so a crash or a full disk
+    // never leaves a truncated cache behind
+    const std::string tempPath = std::string(cachePath) + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing mesh cache %s", tempPath.c_str());
+        return;
+    }
+
+    // Seeking past the end of the file fills the gaps with zeros
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && fseek(file, (long)header.submeshesOffset, SEEK_SET) == 0;
+    written = written && fwrite(cachedSubmeshes.data(), sizeof(MeshCacheSubmesh), cachedSubmeshes.size(), file) == cachedSubmeshes.size();
+    written = written && fseek(file, (long)header.materialsOffset, SEEK_SET) == 0;
+    written = written && fwrite(cachedMaterials.data(), sizeof(MeshCacheMaterial), cachedMaterials.size(), file) == cachedMaterials.size();
+    written = written && fseek(file, (long)header.verticesOffset, SEEK_SET) == 0;
+    for (u32 i = 0; written && i < mesh.submeshes.size(); ++i)
+        written = fwrite(mesh.submeshes[i].vertices.data(), sizeof(float), mesh.submeshes[i].vertices.size(), file) == mesh.submeshes[i].vertices.size();
+    for (u32 i = 0; written && i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        written = fseek(file, (long)(header.indicesOffset + cachedSubmeshes[i].indicesOffset), SEEK_SET) == 0;
+        if (!written)
+            break;
+
+        if (submesh.indexType == GL_UNSIGNED_SHORT)
+        {
+            const std::vector<u16> shortIndices(submesh.indices.begin(), submesh.indices.end());
+            written = fwrite(shortIndices.data(), sizeof(u16), shortIndices.size(), file) == shortIndices.size();
+        }
+        else
+        {
+            written = fwrite(submesh.indices.data(), sizeof(u32), submesh.indices.size(), file) == submesh.indices.size();
+        }
+    }
+
+    written = fflush(file) == 0 && written;
+    written = fclose(file) == 0 && written;
+
+    if (!written)
+    {
+        ELOG("Failed writing mesh cache %s", tempPath.c_str());
+        remove(tempPath.c_str());
+        return;
+    }
+
+    if (!MoveFileReplacing(tempPath.c_str(), cachePath))
+    {
+        ELOG("Failed moving mesh cache %s into place", tempPath.c_str());
+        remove(tempPath.c_str());
+    }
+}
@@ -0,0 +1,78 @@
+//
+// meshcache.h: Cooked binary models, written after importing a model with assimp and
+// memory mapped on later runs. Everything is stored ready to be uploaded, so loading
+// a cached model needs no parsing at all.
+//
+// File layout: MeshCacheHeader, MeshCacheSubmesh table, MeshCacheMaterial table,
+// vertex blob (interleaved as described by each submesh layout) and index blob (16 or 32
+// bits per index, depending on the submesh).
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define MESH_CACHE_MAGIC   0x4853454D // "MESH"
+#define MESH_CACHE_VERSION 8          // Bump it whenever the layout of the structs below changes
+
+#define MESH_CACHE_MAX_ATTRIBUTES 8
+#define MESH_CACHE_MAX_PATH       256
+
+struct MeshCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u32 vertexCompression;  // VERTEX_COMPRESSION of the build that wrote it
+    u64 sourceTimestamp;    // Last write timestamp of the source model
+    u64 sourceSize;         // Size of the source model in bytes
+    u32 submeshCount;
+    u32 materialCount;
+    u64 submeshesOffset;
+    u64 materialsOffset;
+    u64 verticesOffset;
+    u64 indicesOffset;
+    BoundingVolume bounds;
+    vec3 positionOffset;    // Dequantization of the compressed positions, see Mesh
+    f32  positionScale;
+};
+
+struct MeshCacheSubmesh
+{
+    u32 materialIndex;      // Relative to the first material of the model
+    u32 vertexCount;
+    u32 indexCount;
+    u32 indexType;          // the indices are stored with its size
+    u32 stride;
+    u64 verticesOffset;     // Relative to the vertex blob
+    u64 indicesOffset;      // Relative to the index blob
+    u32 attributeCount;
+    VertexBufferAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+    BoundingVolume bounds;
+    u32 lodCount;
+    SubmeshLod lods[MAX_LODS];
+};
+
+struct MeshCacheMaterial
+{
+    char name[MESH_CACHE_MAX_PATH];
+    vec3 albedo;
+    vec3 emissive;
+    f32  smoothness;
+    f32  specular;
+    char albedoTexture[MESH_CACHE_MAX_PATH];
+    char emissiveTexture[MESH_CACHE_MAX_PATH];
+    char specularTexture[MESH_CACHE_MAX_PATH];
+    char normalsTexture[MESH_CACHE_MAX_PATH];
+    char bumpTexture[MESH_CACHE_MAX_PATH];
+};
+
+/**
+ * Loads a model from its cache file. It returns UINT32_MAX if the cache doesn't exist,
+ * is from another version or is older than the source model.
+ */
+u32 LoadModelCache(App* app, const char* filename, const char* cachePath);
+
+/**
+ * Writes the cache file of a model that has just been imported from filename.
+ */
+void SaveModelCache(App* app, const char* filename, const char* cachePath, u32 modelIdx);
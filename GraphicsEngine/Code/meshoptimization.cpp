@@ -0,0 +1,407 @@
+#include "meshoptimization.h"
+#include "profiler.h"
+
+#include <float.h>
+#include <algorithm>
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation"
+#define CACHE_DECAY_POWER   1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+static f32 VertexScore(i32 cachePosition, u32 remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    f32 score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The vertices of the last triangle get a fixed score, so it's not reused straight away
+        if (cachePosition < 3)
+            score = LAST_TRIANGLE_SCORE;
+        else
+            score = glm::pow(1.0f - (cachePosition - 3) / (f32)(VERTEX_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+    }
+
+    // Vertices with few triangles left go first, so they don't end up isolated
+    return score + VALENCE_BOOST_SCALE * glm::pow((f32)remainingTriangles, -VALENCE_BOOST_POWER);
+}
+
+void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount)
+{
+    const u32 triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Triangles of every vertex, the ones not emitted yet first
+    std::vector<u32> remaining(vertexCount, 0);
+    for (u32 i = 0; i < indexCount; ++i)
+        remaining[indices[i]]++;
+
+    std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+    for (u32 v = 0; v < vertexCount; ++v)
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+
+    std::vector<u32> adjacency(indexCount);
+    std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (u32 i = 0; i < indexCount; ++i)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<i32> cachePositions(vertexCount, -1);
+    std::vector<f32> vertexScores(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        vertexScores[v] = VertexScore(-1, remaining[v]);
+
+    std::vector<f32> triangleScores(triangleCount);
+    std::vector<u8> emitted(triangleCount, 0);
+
+    i32 bestTriangle = 0;
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        const u32* triangle = indices + t * 3;
+        triangleScores[t] = vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+        if (triangleScores[t] > triangleScores[bestTriangle])
+            bestTriangle = t;
+    }
+
+    u32 cache[VERTEX_CACHE_SIZE + 3];
+    u32 cacheCount = 0;
+    u32 nextTriangle = 0;
+
+    std::vector<u32> result;
+    result.reserve(triangleCount * 3);
+
+    while (result.size() < triangleCount * 3)
+    {
+        // Nothing left around the cache, restart from the next triangle not emitted
+        if (bestTriangle < 0)
+        {
+            while (emitted[nextTriangle])
+                nextTriangle++;
+            bestTriangle = nextTriangle;
+        }
+
+        const u32* triangle = indices + bestTriangle * 3;
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = 1;
+
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const u32 v = triangle[k];
+            u32* triangles = &adjacency[adjacencyOffsets[v]];
+            for (u32 i = 0; i < remaining[v]; ++i)
+            {
+                if (triangles[i] == (u32)bestTriangle)
+                {
+                    triangles[i] = triangles[remaining[v] - 1];
+                    remaining[v]--;
+                    break;
+                }
+            }
+        }
+
+        // The triangle goes to the front of the LRU cache, pushing the oldest vertices out
+        u32 newCache[VERTEX_CACHE_SIZE + 3];
+        u32 newCacheCount = 0;
+        for (u32 k = 0; k < 3; ++k)
+            newCache[newCacheCount++] = triangle[k];
+        for (u32 i = 0; i < cacheCount; ++i)
+        {
+            const u32 v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                newCache[newCacheCount++] = v;
+        }
+
+        for (u32 i = 0; i < newCacheCount; ++i)
+        {
+            const u32 v = newCache[i];
+            cachePositions[v] = i < VERTEX_CACHE_SIZE ? (i32)i : -1;
+            vertexScores[v] = VertexScore(cachePositions[v], remaining[v]);
+        }
+
+        // Only the triangles around the cache changed their score
+        bestTriangle = -1;
+        f32 bestScore = -FLT_MAX;
+        for (u32 i = 0; i < newCacheCount; ++i)
+        {
+            const u32 v = newCache[i];
+            const u32* triangles = &adjacency[adjacencyOffsets[v]];
+            for (u32 j = 0; j < remaining[v]; ++j)
+            {
+                const u32 t = triangles[j];
+                const u32* other = indices + t * 3;
+                triangleScores[t] = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        cacheCount = glm::min(newCacheCount, (u32)VERTEX_CACHE_SIZE);
+        memcpy(cache, newCache, cacheCount * sizeof(u32));
+    }
+
+    memcpy(indices, result.data(), result.size() * sizeof(u32));
+}
+
+static vec3 ReadPosition(const f32* positions, u32 strideInFloats, u32 vertex)
+{
+    const f32* p = positions + (u64)vertex * strideInFloats;
+    return vec3(p[0], p[1], p[2]);
+}
+
+static f32 ComputeAcmr(const u32* indices, u32 indexCount, u32 vertexCount)
+{
+    return AnalyzeMesh(indices, indexCount, NULL, 0, vertexCount).acmr;
+}
+
+struct TriangleCluster
+{
+    u32 firstTriangle;
+    u32 triangleCount;
+    f32 sortKey;
+};
+
+void OptimizeOverdraw(u32* indices, u32 indexCount, const f32* positions, u32 positionStrideInFloats, u32 vertexCount, f32 threshold)
+{
+    const u32 triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    // A cluster starts wherever the FIFO cache misses the 3 vertices of a triangle,
+    // so moving clusters around barely changes the cache behaviour
+    std::vector<u32> cacheTimestamps(vertexCount, 0);
+    u32 timestamp = VERTEX_CACHE_SIZE_FIFO + 1;
+
+    std::vector<TriangleCluster> clusters;
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        u32 misses = 0;
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const u32 v = indices[t * 3 + k];
+            if (timestamp - cacheTimestamps[v] > VERTEX_CACHE_SIZE_FIFO)
+            {
+                cacheTimestamps[v] = timestamp++;
+                misses++;
+            }
+        }
+
+        if (t == 0 || misses == 3)
+            clusters.push_back(TriangleCluster{ t, 0, 0.0f });
+        clusters.back().triangleCount++;
+    }
+
+    if (clusters.size() < 2)
+        return;
+
+    // Clusters facing away from the center of the mesh are the likely occluders
+    vec3 meshCentroid = vec3(0.0f);
+    f32 meshArea = 0.0f;
+    std::vector<vec3> clusterCentroids(clusters.size());
+    std::vector<vec3> clusterNormals(clusters.size());
+
+    for (u32 c = 0; c < clusters.size(); ++c)
+    {
+        vec3 centroid = vec3(0.0f);
+        vec3 normal = vec3(0.0f);
+        f32 area = 0.0f;
+
+        for (u32 t = clusters[c].firstTriangle; t < clusters[c].firstTriangle + clusters[c].triangleCount; ++t)
+        {
+            const vec3 p0 = ReadPosition(positions, positionStrideInFloats, indices[t * 3 + 0]);
+            const vec3 p1 = ReadPosition(positions, positionStrideInFloats, indices[t * 3 + 1]);
+            const vec3 p2 = ReadPosition(positions, positionStrideInFloats, indices[t * 3 + 2]);
+
+            const vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+            const f32 triangleArea = glm::length(areaNormal);
+
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += areaNormal;
+            area += triangleArea;
+        }
+
+        meshCentroid += centroid;
+        meshArea += area;
+        clusterCentroids[c] = area > 0.0f ? centroid / area : centroid;
+        clusterNormals[c] = glm::length(normal) > 0.0f ? glm::normalize(normal) : normal;
+    }
+
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    for (u32 c = 0; c < clusters.size(); ++c)
+        clusters[c].sortKey = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const TriangleCluster& a, const TriangleCluster& b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    std::vector<u32> sorted;
+    sorted.reserve(indexCount);
+    for (u32 c = 0; c < clusters.size(); ++c)
+        sorted.insert(sorted.end(), indices + clusters[c].firstTriangle * 3, indices + (clusters[c].firstTriangle + clusters[c].triangleCount) * 3);
+
+    if (ComputeAcmr(sorted.data(), sorted.size(), vertexCount) <= ComputeAcmr(indices, indexCount, vertexCount) * threshold)
+        memcpy(indices, sorted.data(), sorted.size() * sizeof(u32));
+}
+
+u32 OptimizeVertexFetch(std::vector<float>& vertices, u32 stride, u32* indices, u32 indexCount)
+{
+    const u32 vertexCount = vertices.size() * sizeof(float) / stride;
+    std::vector<u32> remap(vertexCount, UINT32_MAX);
+    std::vector<float> result(vertices.size());
+
+    u32 newVertexCount = 0;
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        u32& newIndex = remap[indices[i]];
+        if (newIndex == UINT32_MAX)
+        {
+            newIndex = newVertexCount++;
+            memcpy((u8*)result.data() + newIndex * stride, (const u8*)vertices.data() + indices[i] * stride, stride);
+        }
+        indices[i] = newIndex;
+    }
+
+    result.resize(newVertexCount * stride / sizeof(float));
+    vertices.swap(result);
+    return newVertexCount;
+}
+
+// Fragments that pass the depth test (with early-Z, the ones shaded) and pixels covered in
+// an orthographic view down one axis, the triangles drawn in order and without culling
+static void RasterizeView(const u32* indices, u32 indexCount, const f32* positions, u32 strideInFloats,
+                          const BoundingVolume& bounds, u32 axis, bool flip, u64& shaded, u64& covered)
+{
+    const u32 uAxis = (axis + 1) % 3;
+    const u32 vAxis = (axis + 2) % 3;
+    const vec3 extent = glm::max(bounds.aabbMax - bounds.aabbMin, vec3(FLT_EPSILON));
+
+    std::vector<f32> depthBuffer(OVERDRAW_RESOLUTION * OVERDRAW_RESOLUTION, FLT_MAX);
+
+    for (u32 t = 0; t < indexCount / 3; ++t)
+    {
+        vec3 screen[3];
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const vec3 p = (ReadPosition(positions, strideInFloats, indices[t * 3 + k]) - bounds.aabbMin) / extent;
+            screen[k] = vec3(p[uAxis] * OVERDRAW_RESOLUTION, p[vAxis] * OVERDRAW_RESOLUTION, flip ? 1.0f - p[axis] : p[axis]);
+        }
+
+        const f32 area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+        if (area == 0.0f)
+            continue;
+
+        const i32 minX = glm::max((i32)glm::floor(glm::min(screen[0].x, glm::min(screen[1].x, screen[2].x))), 0);
+        const i32 maxX = glm::min((i32)glm::ceil(glm::max(screen[0].x, glm::max(screen[1].x, screen[2].x))), OVERDRAW_RESOLUTION - 1);
+        const i32 minY = glm::max((i32)glm::floor(glm::min(screen[0].y, glm::min(screen[1].y, screen[2].y))), 0);
+        const i32 maxY = glm::min((i32)glm::ceil(glm::max(screen[0].y, glm::max(screen[1].y, screen[2].y))), OVERDRAW_RESOLUTION - 1);
+
+        for (i32 y = minY; y <= maxY; ++y)
+        {
+            for (i32 x = minX; x <= maxX; ++x)
+            {
+                const f32 px = x + 0.5f;
+                const f32 py = y + 0.5f;
+
+                // Barycentrics from the edge functions, the sign of the area makes both windings inside
+                const f32 w0 = ((screen[2].x - screen[1].x) * (py - screen[1].y) - (screen[2].y - screen[1].y) * (px - screen[1].x)) / area;
+                const f32 w1 = ((screen[0].x - screen[2].x) * (py - screen[2].y) - (screen[0].y - screen[2].y) * (px - screen[2].x)) / area;
+                const f32 w2 = 1.0f - w0 - w1;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    continue;
+
+                const f32 depth = w0 * screen[0].z + w1 * screen[1].z + w2 * screen[2].z;
+                f32& storedDepth = depthBuffer[y * OVERDRAW_RESOLUTION + x];
+                if (depth < storedDepth)
+                {
+                    if (storedDepth == FLT_MAX)
+                        covered++;
+                    storedDepth = depth;
+                    shaded++;
+                }
+            }
+        }
+    }
+}
+
+MeshOptimizationStats AnalyzeMesh(const u32* indices, u32 indexCount, const f32* positions, u32 positionStrideInFloats, u32 vertexCount)
+{
+    MeshOptimizationStats stats = {};
+    const u32 triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return stats;
+
+    // FIFO cache, like the post-transform cache of most GPUs
+    std::vector<u32> cacheTimestamps(vertexCount, 0);
+    std::vector<u8> referenced(vertexCount, 0);
+    u32 timestamp = VERTEX_CACHE_SIZE_FIFO + 1;
+    u32 misses = 0;
+    u32 referencedCount = 0;
+
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        const u32 v = indices[i];
+        if (timestamp - cacheTimestamps[v] > VERTEX_CACHE_SIZE_FIFO)
+        {
+            cacheTimestamps[v] = timestamp++;
+            misses++;
+        }
+
+        referencedCount += referenced[v] ? 0 : 1;
+        referenced[v] = 1;
+    }
+
+    stats.acmr = (f32)misses / triangleCount;
+    stats.atvr = (f32)misses / referencedCount;
+
+    if (!positions)
+        return stats;
+
+    BoundingVolume bounds = {};
+    bounds.aabbMin = vec3(FLT_MAX);
+    bounds.aabbMax = vec3(-FLT_MAX);
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        const vec3 p = ReadPosition(positions, positionStrideInFloats, indices[i]);
+        bounds.aabbMin = glm::min(bounds.aabbMin, p);
+        bounds.aabbMax = glm::max(bounds.aabbMax, p);
+    }
+
+    u64 shaded = 0;
+    u64 covered = 0;
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+        RasterizeView(indices, indexCount, positions, positionStrideInFloats, bounds, axis, false, shaded, covered);
+        RasterizeView(indices, indexCount, positions, positionStrideInFloats, bounds, axis, true, shaded, covered);
+    }
+
+    stats.overdraw = covered > 0 ? (f32)shaded / covered : 0.0f;
+    return stats;
+}
+
+void OptimizeSubmesh(Submesh& submesh, MeshOptimizationStats* before, MeshOptimizationStats* after)
+{
+    PROFILE_SCOPE("OptimizeSubmesh");
+
+    const u32 stride = submesh.vertexBufferLayout.stride;
+    const u32 strideInFloats = stride / sizeof(float);
+    u32 vertexCount = submesh.vertices.size() * sizeof(float) / stride;
+    u32* indices = submesh.indices.data();
+    const u32 indexCount = submesh.indices.size();
+
+    if (before)
+        *before = AnalyzeMesh(indices, indexCount, submesh.vertices.data(), strideInFloats, vertexCount);
+
+    OptimizeVertexCache(indices, indexCount, vertexCount);
+    OptimizeOverdraw(indices, indexCount, submesh.vertices.data(), strideInFloats, vertexCount, OVERDRAW_THRESHOLD);
+    vertexCount = OptimizeVertexFetch(submesh.vertices, stride, indices, indexCount);
+
+    if (after)
+        *after = AnalyzeMesh(indices, indexCount, submesh.vertices.data(), strideInFloats, vertexCount);
+}
@@ -0,0 +1,48 @@
+//
+// meshoptimization.h: Reordering of the triangles and vertices of imported submeshes
+// so the GPU transforms, fetches and shades as little as possible:
+// - Vertex cache: triangles are emitted with Forsyth's scoring, so consecutive
+//   triangles reuse the vertices still in the post-transform cache.
+// - Overdraw: the triangles are split into clusters where the cache restarts, and the
+//   clusters facing outwards are drawn first so they occlude the rest early.
+// - Vertex fetch: vertices are stored in the order they are first used.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define VERTEX_CACHE_SIZE      32       // entries of the cache simulated by the Forsyth optimizer
+#define VERTEX_CACHE_SIZE_FIFO 16       // entries of the FIFO cache used to measure the result
+#define OVERDRAW_THRESHOLD     1.05f    // worst ACMR ratio accepted in exchange for less overdraw
+#define OVERDRAW_RESOLUTION    256      // of the views rasterized to measure the overdraw
+
+struct MeshOptimizationStats
+{
+    f32 acmr;       // average cache miss ratio: vertices transformed per triangle (0.5 is ideal, 3 the worst)
+    f32 atvr;       // average transform to vertex ratio: vertices transformed per vertex (1 is ideal)
+    f32 overdraw;   // fragments shaded per pixel covered, averaged over 6 axis aligned views
+};
+
+void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount);
+
+/**
+ * Sorts the clusters of an index buffer already optimized for the vertex cache by
+ * how much they face outwards. The previous order is kept if the ACMR would grow
+ * by more than threshold times.
+ */
+void OptimizeOverdraw(u32* indices, u32 indexCount, const f32* positions, u32 positionStrideInFloats, u32 vertexCount, f32 threshold);
+
+/**
+ * Reorders the vertices in the order the indices first reference them, dropping
+ * the unreferenced ones. It returns the new vertex count.
+ */
+u32 OptimizeVertexFetch(std::vector<float>& vertices, u32 stride, u32* indices, u32 indexCount);
+
+MeshOptimizationStats AnalyzeMesh(const u32* indices, u32 indexCount, const f32* positions, u32 positionStrideInFloats, u32 vertexCount);
+
+/**
+ * Runs the three optimizations on a submesh with float vertices (the position being
+ * the first 3 floats of every vertex), filling the stats before and after.
+ */
+void OptimizeSubmesh(Submesh& submesh, MeshOptimizationStats* before, MeshOptimizationStats* after);
@@ -9,25 +9,50 @@
     #define WIN32_LEAN_AND_MEAN
     #define _CRT_SECURE_NO_WARNINGS
     #include <Windows.h>
+    #include <psapi.h>
 #else
     #include <sys/types.h>
     #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <sys/resource.h>
+    #include <fcntl.h>
     #include <unistd.h>
 #endif
 
 #include "engine.h"
+#include "benchmark.h"
+#include "filewatcher.h"
+#include "jobs.h"
+#include "profiler.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <stb_image_write.h>
+
+#ifdef __linux__
+    // Headless contexts come from EGL, without pulling the X11 headers
+    #define EGL_NO_X11
+    #define MESA_EGL_NO_X11_HEADERS
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+#endif
 
 #define WINDOW_TITLE  "Advanced Graphics Programming"
 #define WINDOW_WIDTH  800
 #define WINDOW_HEIGHT 600
 
 #define GLOBAL_FRAME_ARENA_SIZE MB(16)
+
+#define CACHE_DIRECTORY "Cache"
+#define FRAME_DIRECTORY "Frames"
+
+#define HEADLESS_DEFAULT_FRAME_COUNT 100
 u8* GlobalFrameArenaMemory = NULL;
 u32 GlobalFrameArenaHead = 0;
 
@@ -114,13 +139,356 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+static void MakeDirectory(const char* path)
+{
+#ifdef _WIN32
+    CreateDirectoryA(path, NULL);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+// GL context without a visible window: EGL surfaceless (Mesa llvmpipe works) on Linux,
+// a hidden GLFW window elsewhere. Either way the frames are rendered into an FBO
+struct HeadlessContext
+{
+#ifdef __linux__
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface;
+#else
+    GLFWwindow* window;
+#endif
+};
+
+static bool CreateHeadlessContext(HeadlessContext& headless)
+{
+#ifdef __linux__
+    // The surfaceless platform needs neither a display server nor a GPU
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    headless.display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    if (headless.display == EGL_NO_DISPLAY)
+        headless.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if (headless.display == EGL_NO_DISPLAY || !eglInitialize(headless.display, NULL, NULL))
+    {
+        ELOG("Could not initialize an EGL display");
+        return false;
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config = NULL;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(headless.display, configAttributes, &config, 1, &configCount) || configCount == 0)
+    {
+        ELOG("No EGL config supports desktop OpenGL");
+        return false;
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    eglBindAPI(EGL_OPENGL_API);
+    headless.context = eglCreateContext(headless.display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (headless.context == EGL_NO_CONTEXT)
+    {
+        ELOG("Could not create an OpenGL 4.3 core context with EGL");
+        return false;
+    }
+
+    // Without KHR_surfaceless_context the context needs some surface, even if it is never drawn to
+    headless.surface = EGL_NO_SURFACE;
+    if (!eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless.context))
+    {
+        const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        headless.surface = eglCreatePbufferSurface(headless.display, config, pbufferAttributes);
+        if (!eglMakeCurrent(headless.display, headless.surface, headless.surface, headless.context))
+        {
+            ELOG("eglMakeCurrent() failed");
+            return false;
+        }
+    }
+
+    return gladLoadGLLoader((GLADloadproc)eglGetProcAddress) != 0;
+#else
+    glfwSetErrorCallback(OnGlfwError);
+
+    if (!glfwInit())
+    {
+        ELOG("glfwInit() failed\n");
+        return false;
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    headless.window = glfwCreateWindow(1, 1, WINDOW_TITLE, NULL, NULL);
+    if (!headless.window)
+    {
+        ELOG("glfwCreateWindow() failed\n");
+        return false;
+    }
+
+    glfwMakeContextCurrent(headless.window);
+    return gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) != 0;
+#endif
+}
+
+static GLADloadproc GetHeadlessProcAddress()
+{
+#ifdef __linux__
+    return (GLADloadproc)eglGetProcAddress;
+#else
+    return (GLADloadproc)glfwGetProcAddress;
+#endif
+}
+
+static void DestroyHeadlessContext(HeadlessContext& headless)
+{
+#ifdef __linux__
+    eglMakeCurrent(headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (headless.surface != EGL_NO_SURFACE)
+        eglDestroySurface(headless.display, headless.surface);
+    eglDestroyContext(headless.display, headless.context);
+    eglTerminate(headless.display);
+#else
+    glfwDestroyWindow(headless.window);
+    glfwTerminate();
+#endif
+}
+
+static void WriteFramePng(const App& app, u32 frameIndex, std::vector<u8>& pixels)
+{
+    const ivec2 size = app.displaySize;
+    pixels.resize(size.x * size.y * 4);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, app.outputFramebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    char filepath[64];
+    snprintf(filepath, sizeof(filepath), FRAME_DIRECTORY "/frame_%05u.png", frameIndex);
+
+    // GL rows go bottom to top
+    stbi_flip_vertically_on_write(1);
+    if (!stbi_write_png(filepath, size.x, size.y, 4, pixels.data(), size.x * 4))
+        ELOG("Could not write %s", filepath);
+}
+
+/**
+ * Renders frameCount frames into an offscreen framebuffer of app.displaySize, without
+ * window, input or ImGui, writing every dumpInterval-th frame as a png (0 for none).
+ * With a benchmark config, the synthetic scene and its camera path are rendered instead
+ * (frameCount is then ignored) and the results written when done.
+ */
+static int RunHeadless(App& app, u32 frameCount, u32 dumpInterval, const BenchmarkConfig* benchmarkConfig = NULL)
+{
+    HeadlessContext headless = {};
+    if (!CreateHeadlessContext(headless))
+    {
+        ELOG("Failed to create a headless OpenGL context\n");
+        return -1;
+    }
+
+    LoadGLExtensions(GetHeadlessProcAddress());
+
+    GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
+
+    Init(&app);
+
+    // Stands in for the window's default framebuffer
+    GLuint renderbuffers[2];
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, app.displaySize.x, app.displaySize.y);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, app.displaySize.x, app.displaySize.y);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &app.outputFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, app.outputFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        ELOG("Headless framebuffer is incomplete\n");
+        return -1;
+    }
+
+    if (dumpInterval > 0)
+        MakeDirectory(FRAME_DIRECTORY);
+
+    SceneBenchmark benchmark;
+    if (benchmarkConfig)
+    {
+        if (!InitSceneBenchmark(&app, benchmark, *benchmarkConfig))
+            return -1;
+        frameCount = GetBenchmarkFrameCount(benchmark);
+    }
+
+    std::vector<u8> pixels;
+    const u64 startTimestamp = GetTimestampNs();
+    u64 lastFrameTimestamp = startTimestamp;
+
+    for (u32 frame = 0; frame < frameCount && app.isRunning; ++frame)
+    {
+        ProfilerBeginFrame();
+
+        if (benchmarkConfig)
+            BeginBenchmarkFrame(&app, benchmark);
+
+        {
+            PROFILE_SCOPE("Update");
+            Update(&app);
+        }
+
+        {
+            PROFILE_SCOPE("Render");
+            Render(&app);
+        }
+
+        if (dumpInterval > 0 && frame % dumpInterval == 0)
+        {
+            PROFILE_SCOPE("WriteFramePng");
+            WriteFramePng(app, frame, pixels);
+        }
+
+        // Nothing is presented, so flush the frame's commands like a swap would
+        glFlush();
+
+        const u64 frameTimestamp = GetTimestampNs();
+        app.deltaTime = (frameTimestamp - lastFrameTimestamp) / 1e9f;
+
+        if (benchmarkConfig)
+            EndBenchmarkFrame(&app, benchmark, frameTimestamp - lastFrameTimestamp);
+
+        lastFrameTimestamp = frameTimestamp;
+
+        GlobalFrameArenaHead = 0;
+    }
+
+    glFinish();
+    const f64 seconds = (GetTimestampNs() - startTimestamp) / 1e9;
+    ILOG("Rendered %u frames at %dx%d in %.2f s (%.3f ms per frame)", frameCount, app.displaySize.x, app.displaySize.y,
+         seconds, frameCount > 0 ? seconds * 1e3 / frameCount : 0.0);
+
+    if (benchmarkConfig && !WriteBenchmarkResults(&app, benchmark))
+        return -1;
+
+    glDeleteFramebuffers(1, &app.outputFramebuffer);
+    glDeleteRenderbuffers(2, renderbuffers);
+
+    free(GlobalFrameArenaMemory);
+
+    DestroyHeadlessContext(headless);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
 {
     App app         = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
     app.isRunning   = true;
 
+    ProfilerSetThreadName("Main");
+    InitJobSystem(0);
+
+    bool headless = false;
+    u32 headlessFrameCount = HEADLESS_DEFAULT_FRAME_COUNT;
+    u32 dumpInterval = 0;
+
+    bool benchmark = false;
+    BenchmarkConfig benchmarkConfig;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--benchmark-jobs") == 0)
+        {
+            RunJobSystemBenchmark();
+            ShutdownJobSystem();
+            return 0;
+        }
+
+        // --trace [frames]: capture the first frames, loading included
+        if (strcmp(argv[i], "--trace") == 0)
+        {
+            u32 frameCount = TRACE_CAPTURE_FRAMES;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                frameCount = atoi(argv[++i]);
+            StartTraceCapture(frameCount);
+        }
+
+        // --headless [--frames N] [--resolution WxH] [--dump-frames N]: render offscreen and exit
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            headlessFrameCount = benchmarkConfig.frameCount = atoi(argv[++i]);
+
+        if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc)
+        {
+            int width = 0, height = 0;
+            if (sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+                app.displaySize = ivec2(width, height);
+            else
+                ELOG("Invalid resolution %s, expected WxH", argv[i]);
+        }
+
+        if (strcmp(argv[i], "--dump-frames") == 0 && i + 1 < argc)
+            dumpInterval = atoi(argv[++i]);
+
+        // --benchmark [--entities N] [--lights M] [--materials K] [--seed S] [--mode forward|deferred]
+        // [--submission per-entity|instanced|indirect] [--output path]: headless run of the synthetic scene
+        if (strcmp(argv[i], "--benchmark") == 0)
+            benchmark = true;
+
+        if (strcmp(argv[i], "--entities") == 0 && i + 1 < argc)
+            benchmarkConfig.entityCount = atoi(argv[++i]);
+
+        if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            benchmarkConfig.lightCount = atoi(argv[++i]);
+
+        if (strcmp(argv[i], "--materials") == 0 && i + 1 < argc)
+            benchmarkConfig.materialCount = atoi(argv[++i]);
+
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            benchmarkConfig.seed = atoi(argv[++i]);
+
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc && !ParseBenchmarkMode(argv[++i], benchmarkConfig.mode))
+            ELOG("Unknown mode %s", argv[i]);
+
+        if (strcmp(argv[i], "--submission") == 0 && i + 1 < argc && !ParseBenchmarkSubmission(argv[++i], benchmarkConfig.submission))
+            ELOG("Unknown submission %s", argv[i]);
+
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            benchmarkConfig.outputPath = argv[++i];
+    }
+
+    if (headless || benchmark)
+    {
+        app.headless = true;
+        int result = RunHeadless(app, headlessFrameCount, dumpInterval, benchmark ? &benchmarkConfig : NULL);
+        CancelTextureLoads(&app);
+        ShutdownJobSystem();
+        ShutdownProfiler();
+        return result;
+    }
+
 		glfwSetErrorCallback(OnGlfwError);
 
     if (!glfwInit())
@@ -160,6 +528,8 @@ int main()
         return -1;
     }
 
+    LoadGLExtensions((GLADloadproc) glfwGetProcAddress);
+
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -199,19 +569,29 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    StartFileWatcher();
+
     Init(&app);
 
     while (app.isRunning)
     {
+        ProfilerBeginFrame();
+
         // Tell GLFW to call platform callbacks
-        glfwPollEvents();
+        {
+            PROFILE_SCOPE("PollEvents");
+            glfwPollEvents();
+        }
 
         // ImGui
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
-        Gui(&app);
-        ImGui::Render();
+        {
+            PROFILE_SCOPE("Gui");
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            Gui(&app);
+            ImGui::Render();
+        }
 
         // Clear input state if required by ImGui
         if (ImGui::GetIO().WantCaptureKeyboard)
@@ -222,8 +602,16 @@ int main()
             for (u32 i = 0; i < MOUSE_BUTTON_COUNT; ++i)
                 app.input.mouseButtons[i] = BUTTON_IDLE;
 
+        // A minimized window has a 0x0 framebuffer: the projection would divide by zero and there's
+        // nothing to render into, so the frame keeps only the events and ImGui until it's restored
+        const bool minimized = app.displaySize.x == 0 || app.displaySize.y == 0;
+
         // Update
-        Update(&app);
+        if (!minimized)
+        {
+            PROFILE_SCOPE("Update");
+            Update(&app);
+        }
 
         // Transition input key/button states
         if (!ImGui::GetIO().WantCaptureKeyboard)
@@ -239,19 +627,29 @@ int main()
         app.input.mouseDelta = glm::vec2(0.0f, 0.0f);
 
         // Render
-        Render(&app);
+        if (!minimized)
+        {
+            PROFILE_SCOPE("Render");
+            Render(&app);
+        }
 
         // ImGui Render
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
-            GLFWwindow* backup_current_context = glfwGetCurrentContext();
-            ImGui::UpdatePlatformWindows();
-            ImGui::RenderPlatformWindowsDefault();
-            glfwMakeContextCurrent(backup_current_context);
+        {
+            PROFILE_SCOPE("ImGuiRender");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
+                GLFWwindow* backup_current_context = glfwGetCurrentContext();
+                ImGui::UpdatePlatformWindows();
+                ImGui::RenderPlatformWindowsDefault();
+                glfwMakeContextCurrent(backup_current_context);
+            }
         }
 
         // Present image on screen
-        glfwSwapBuffers(window);
+        {
+            PROFILE_SCOPE("SwapBuffers");
+            glfwSwapBuffers(window);
+        }
 
         // Frame time
         f64 currentFrameTime = glfwGetTime();
@@ -262,6 +660,12 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    StopFileWatcher();
+
+    // No job may outlive the context or the app
+    CancelTextureLoads(&app);
+    ShutdownJobSystem();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -271,6 +675,8 @@ int main()
 
     glfwTerminate();
 
+    ShutdownProfiler();
+
     return 0;
 }
 
@@ -399,6 +805,164 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+u64 GetFileSize(const char* filepath)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    if (GetFileAttributesExA(filepath, GetFileExInfoStandard, &Data))
+        return ((u64)Data.nFileSizeHigh << 32) | Data.nFileSizeLow;
+#else
+    struct stat attrib;
+    if (stat(filepath, &attrib) == 0)
+        return attrib.st_size;
+#endif
+
+    return 0;
+}
+
+bool MoveFileReplacing(const char* source, const char* destination)
+{
+#ifdef _WIN32
+    return MoveFileExA(source, destination, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(source, destination) == 0;
+#endif
+}
+
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile file = {};
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return file;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(fileHandle, &size);
+
+    HANDLE mappingHandle = size.QuadPart > 0 ? CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    const void* data = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    if (!data)
+    {
+        if (mappingHandle) CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    file.data = data;
+    file.size = size.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return file;
+
+    struct stat attrib;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &attrib) == 0 && attrib.st_size > 0)
+        data = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps the file alive
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return file;
+
+    file.data = data;
+    file.size = attrib.st_size;
+#endif
+
+    return file;
+}
+
+void UnmapFile(MappedFile& file)
+{
+    if (!file.data)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle(file.mappingHandle);
+    CloseHandle(file.fileHandle);
+#else
+    munmap((void*)file.data, file.size);
+#endif
+
+    file = {};
+}
+
+String MakeCachePath(const char* filepath, const char* extension)
+{
+    MakeDirectory(CACHE_DIRECTORY);
+
+    const u32 directoryLen = Strlen(CACHE_DIRECTORY);
+
+    String path = {};
+    path.len = directoryLen + 1 + Strlen(filepath) + Strlen(extension);
+    path.str = (char*)PushSize(path.len + 1);
+    sprintf(path.str, "%s/%s%s", CACHE_DIRECTORY, filepath, extension);
+
+    // Flatten the source path into a single file name
+    for (u32 i = directoryLen + 1; i < path.len; ++i)
+        if (path.str[i] == '/' || path.str[i] == '\\' || path.str[i] == ':')
+            path.str[i] = '_';
+
+    return path;
+}
+
+u64 HashBytes(const void* bytes, u64 byteCount, u64 hash)
+{
+    const u8* byte = (const u8*)bytes;
+    while (byteCount--)
+        hash = (hash ^ *byte++) * 1099511628211ull;
+    return hash;
+}
+
+u64 GetTimestampNs()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+u64 GetPeakMemoryUsage()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return (u64)usage.ru_maxrss * 1024; // in KB on Linux
+    return 0;
+#endif
+}
+
+void* AlignedAlloc(u64 size, u32 alignment)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+void AlignedFree(void* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
@@ -84,6 +84,87 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * It returns the size in bytes of a file, or 0 if it doesn't exist.
+ */
+u64 GetFileSize(const char *filepath);
+
+/**
+ * Moves a file over destination, replacing it if it exists. Files written under a
+ * temporary name and moved into place are never seen half written.
+ */
+bool MoveFileReplacing(const char *source, const char *destination);
+
+/**
+ * A read-only view of a whole file mapped into memory. Data is NULL if the
+ * file could not be mapped.
+ */
+struct MappedFile
+{
+    const void* data;
+    u64         size;
+    void*       fileHandle;
+    void*       mappingHandle;
+};
+
+MappedFile MapFile(const char *filepath);
+
+void UnmapFile(MappedFile& file);
+
+/**
+ * It returns the path of a file inside the cache directory (created if needed),
+ * named after the source filepath plus the given extension. The returned string
+ * is temporary, like the ones returned by MakeString.
+ */
+String MakeCachePath(const char *filepath, const char *extension);
+
+/**
+ * FNV-1a hash of a block of memory. Passing the result of a previous call as
+ * hash allows hashing several blocks together.
+ */
+u64 HashBytes(const void* bytes, u64 byteCount, u64 hash = 14695981039346656037ull);
+
+/**
+ * It returns a monotonic timestamp in nanoseconds, only meaningful when compared
+ * with other timestamps (e.g. to measure elapsed times).
+ */
+u64 GetTimestampNs();
+
+// Largest resident set (working set on Windows) of the process so far, in bytes
+u64 GetPeakMemoryUsage();
+
+/**
+ * Allocates memory whose address is a multiple of alignment (a power of 2).
+ * It must be released with AlignedFree.
+ */
+void* AlignedAlloc(u64 size, u32 alignment);
+
+void AlignedFree(void* ptr);
+
+/**
+ * Allocator to use AlignedAlloc with the standard containers, e.g. to keep arrays
+ * of matrices aligned for SIMD loads.
+ */
+template <typename T, u32 Alignment>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) { return (T*)AlignedAlloc(count * sizeof(T), Alignment); }
+    void deallocate(T* ptr, size_t) { AlignedFree(ptr); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, 16>>;
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
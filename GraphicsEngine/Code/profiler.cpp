@@ -0,0 +1,415 @@
+#include "profiler.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define PROFILER_THREAD_NAME_SIZE 32
+
+// Track of the GPU scopes in the trace files
+#define TRACE_GPU_THREAD PROFILER_MAX_THREADS
+
+struct ThreadProfile
+{
+    std::mutex  mutex;      // the owner writes zones under it, the main thread reads them under it
+    char        name[PROFILER_THREAD_NAME_SIZE];
+    ProfileZone zones[PROFILER_ZONES_PER_THREAD];
+    u64         zoneCount;  // zones recorded so far, the ring holds the most recent ones
+    u64         traceCount; // zones already copied into the trace capture
+    u32         depth;      // only used by the owner
+    u32         index;
+    bool        exited;     // its thread is gone, the next new thread takes the profile over
+};
+
+struct CapturedZone
+{
+    ProfileZone zone;
+    u32         threadIdx;
+};
+
+struct TraceCapture
+{
+    std::vector<CapturedZone> zones;
+    char threadNames[PROFILER_MAX_THREADS][PROFILER_THREAD_NAME_SIZE];
+    u32  threadCount;
+    char filepath[64];
+};
+
+// Thread profiles are never freed, so a zone pointer stays valid after its thread exits.
+// The profiles of exited threads are reused, so threads coming and going don't run out of them
+static std::mutex              GlobalThreadsMutex;
+static ThreadProfile*          GlobalThreads[PROFILER_MAX_THREADS];
+static std::atomic<u32>        GlobalThreadCount{ 0 };
+static thread_local ThreadProfile* LocalThread = NULL;
+
+// Marks the profile of the thread as free when the thread exits
+struct ThreadProfileRelease
+{
+    ~ThreadProfileRelease()
+    {
+        if (!LocalThread)
+            return;
+
+        std::lock_guard<std::mutex> lock(LocalThread->mutex);
+        LocalThread->exited = true;
+        LocalThread = NULL;
+    }
+};
+
+static thread_local ThreadProfileRelease LocalThreadRelease;
+
+// Only touched by the main thread
+static u64  GlobalFrameBegin;
+static f32  GlobalFrameTimes[PROFILER_FRAME_HISTORY]; // ms
+static u32  GlobalFrameCount;
+static bool GlobalPaused;
+
+static std::vector<CapturedZone> GlobalCapturedZones;
+static char GlobalCapturedThreadNames[PROFILER_MAX_THREADS][PROFILER_THREAD_NAME_SIZE];
+static u64  GlobalCapturedBegin;
+static u64  GlobalCapturedEnd;
+
+static TraceCapture* GlobalTrace = NULL;    // the capture in progress
+static u32           GlobalTraceFramesLeft;
+static u64           GlobalTraceDroppedZones;
+static std::thread   GlobalTraceWriter;
+
+static ThreadProfile* GetThreadProfile()
+{
+    if (LocalThread)
+        return LocalThread;
+
+    std::lock_guard<std::mutex> lock(GlobalThreadsMutex);
+
+    // Touching the release object registers its destructor for this thread
+    (void)&LocalThreadRelease;
+
+    // The zone counts keep growing, so the zones of the previous owner age out of the ring like any other
+    for (u32 t = 0; t < GlobalThreadCount; ++t)
+    {
+        ThreadProfile* thread = GlobalThreads[t];
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        if (!thread->exited)
+            continue;
+
+        thread->exited = false;
+        thread->depth = 0;
+        snprintf(thread->name, sizeof(thread->name), "Thread %u", t);
+        LocalThread = thread;
+        return LocalThread;
+    }
+
+    const u32 threadIdx = GlobalThreadCount;
+    if (threadIdx == PROFILER_MAX_THREADS)
+        return NULL;
+
+    LocalThread = new ThreadProfile();
+    LocalThread->index = threadIdx;
+    snprintf(LocalThread->name, sizeof(LocalThread->name), "Thread %u", threadIdx);
+
+    GlobalThreads[threadIdx] = LocalThread;
+    GlobalThreadCount = threadIdx + 1;
+
+    return LocalThread;
+}
+
+ProfileScope::ProfileScope(const char* name) : name(name)
+{
+    if (ThreadProfile* thread = GetThreadProfile())
+        thread->depth++;
+
+    begin = GetTimestampNs();
+}
+
+ProfileScope::~ProfileScope()
+{
+    const u64 end = GetTimestampNs();
+
+    ThreadProfile* thread = LocalThread;
+    if (!thread)
+        return;
+
+    thread->depth--;
+
+    std::lock_guard<std::mutex> lock(thread->mutex);
+    thread->zones[thread->zoneCount % PROFILER_ZONES_PER_THREAD] = ProfileZone{ name, begin, end, thread->depth };
+    thread->zoneCount++;
+}
+
+void ProfilerSetThreadName(const char* name)
+{
+    ThreadProfile* thread = GetThreadProfile();
+    if (!thread)
+        return;
+
+    std::lock_guard<std::mutex> lock(thread->mutex);
+    snprintf(thread->name, sizeof(thread->name), "%s", name);
+}
+
+static void CaptureZones(u64 begin, u64 end)
+{
+    GlobalCapturedZones.clear();
+    GlobalCapturedBegin = begin;
+    GlobalCapturedEnd = end;
+
+    const u32 threadCount = GlobalThreadCount;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        ThreadProfile* thread = GlobalThreads[t];
+        std::lock_guard<std::mutex> lock(thread->mutex);
+
+        memcpy(GlobalCapturedThreadNames[t], thread->name, PROFILER_THREAD_NAME_SIZE);
+
+        // Zones are recorded when they end, so the ring is sorted by end time: walk it back
+        // from the newest one until the zones end before the frame
+        const u64 oldest = thread->zoneCount > PROFILER_ZONES_PER_THREAD ? thread->zoneCount - PROFILER_ZONES_PER_THREAD : 0;
+        for (u64 i = thread->zoneCount; i-- > oldest;)
+        {
+            const ProfileZone& zone = thread->zones[i % PROFILER_ZONES_PER_THREAD];
+            if (zone.end < begin)
+                break;
+
+            if (zone.begin < end)
+                GlobalCapturedZones.push_back(CapturedZone{ zone, t });
+        }
+    }
+}
+
+static void WriteTrace(TraceCapture* trace)
+{
+    FILE* file = fopen(trace->filepath, "wb");
+    if (!file)
+    {
+        ELOG("Could not create the trace file %s", trace->filepath);
+        delete trace;
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for (u32 t = 0; t < trace->threadCount; ++t)
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n", t, trace->threadNames[t]);
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", TRACE_GPU_THREAD);
+
+    // Timestamps in microseconds, relative to the first zone so they keep their precision
+    u64 origin = UINT64_MAX;
+    for (u32 i = 0; i < trace->zones.size(); ++i)
+        origin = glm::min(origin, trace->zones[i].zone.begin);
+
+    for (u32 i = 0; i < trace->zones.size(); ++i)
+    {
+        const CapturedZone& captured = trace->zones[i];
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                captured.zone.name, captured.threadIdx, (captured.zone.begin - origin) / 1e3, (captured.zone.end - captured.zone.begin) / 1e3);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    ILOG("Trace written to %s (%u zones)", trace->filepath, (u32)trace->zones.size());
+    delete trace;
+}
+
+// Moves the zones recorded since the last call into the trace capture
+static void CollectTraceZones()
+{
+    const u32 threadCount = GlobalThreadCount;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        ThreadProfile* thread = GlobalThreads[t];
+        std::lock_guard<std::mutex> lock(thread->mutex);
+
+        memcpy(GlobalTrace->threadNames[t], thread->name, PROFILER_THREAD_NAME_SIZE);
+
+        // A thread that recorded more zones than its ring holds since the last frame loses the oldest ones
+        if (thread->zoneCount - thread->traceCount > PROFILER_ZONES_PER_THREAD)
+        {
+            GlobalTraceDroppedZones += thread->zoneCount - thread->traceCount - PROFILER_ZONES_PER_THREAD;
+            thread->traceCount = thread->zoneCount - PROFILER_ZONES_PER_THREAD;
+        }
+
+        for (u64 i = thread->traceCount; i < thread->zoneCount; ++i)
+            GlobalTrace->zones.push_back(CapturedZone{ thread->zones[i % PROFILER_ZONES_PER_THREAD], t });
+        thread->traceCount = thread->zoneCount;
+    }
+
+    GlobalTrace->threadCount = threadCount;
+}
+
+void StartTraceCapture(u32 frameCount)
+{
+    if (GlobalTrace || frameCount == 0)
+        return;
+
+    GlobalTrace = new TraceCapture();
+    GlobalTraceFramesLeft = frameCount;
+    GlobalTraceDroppedZones = 0;
+    snprintf(GlobalTrace->filepath, sizeof(GlobalTrace->filepath), "trace_%llu.json", (unsigned long long)time(NULL));
+
+    // Only the zones recorded from now on go into the capture
+    const u32 threadCount = GlobalThreadCount;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        std::lock_guard<std::mutex> lock(GlobalThreads[t]->mutex);
+        GlobalThreads[t]->traceCount = GlobalThreads[t]->zoneCount;
+    }
+
+    ILOG("Capturing a trace of %u frames", frameCount);
+}
+
+bool IsTraceCaptureActive()
+{
+    return GlobalTrace != NULL;
+}
+
+void TraceGpuZone(const char* name, u64 begin, u64 end)
+{
+    if (GlobalTrace)
+        GlobalTrace->zones.push_back(CapturedZone{ ProfileZone{ name, begin, end, 0 }, TRACE_GPU_THREAD });
+}
+
+static void UpdateTraceCapture(u64 frameBegin, u64 frameEnd)
+{
+    CollectTraceZones();
+
+    if (ThreadProfile* mainThread = GetThreadProfile())
+        GlobalTrace->zones.push_back(CapturedZone{ ProfileZone{ "Frame", frameBegin, frameEnd, 0 }, mainThread->index });
+
+    if (--GlobalTraceFramesLeft > 0)
+        return;
+
+    if (GlobalTraceDroppedZones > 0)
+        ELOG("The trace lost %llu zones, the per-thread rings filled up within a frame", (unsigned long long)GlobalTraceDroppedZones);
+
+    // Formatting and writing the file would take a few frames, so it happens in the background
+    if (GlobalTraceWriter.joinable())
+        GlobalTraceWriter.join();
+    GlobalTraceWriter = std::thread(WriteTrace, GlobalTrace);
+    GlobalTrace = NULL;
+}
+
+void ShutdownProfiler()
+{
+    if (GlobalTraceWriter.joinable())
+        GlobalTraceWriter.join();
+}
+
+void ProfilerBeginFrame()
+{
+    const u64 now = GetTimestampNs();
+
+    if (GlobalFrameBegin != 0)
+    {
+        GlobalFrameTimes[GlobalFrameCount % PROFILER_FRAME_HISTORY] = (now - GlobalFrameBegin) / 1e6f;
+        GlobalFrameCount++;
+
+        if (!GlobalPaused)
+            CaptureZones(GlobalFrameBegin, now);
+
+        if (GlobalTrace)
+            UpdateTraceCapture(GlobalFrameBegin, now);
+    }
+
+    GlobalFrameBegin = now;
+}
+
+static f32 Percentile(const std::vector<f32>& sortedValues, f32 percentile)
+{
+    return sortedValues[(u32)(percentile * (sortedValues.size() - 1) + 0.5f)];
+}
+
+static void DrawFlameView()
+{
+    const f64 duration = (f64)(GlobalCapturedEnd - GlobalCapturedBegin);
+    if (duration <= 0.0)
+        return;
+
+    ImGui::Text("Captured frame: %.3f ms, %u zones", duration / 1e6, (u32)GlobalCapturedZones.size());
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    const f32 rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    const f32 width = ImGui::GetContentRegionAvail().x;
+
+    const u32 threadCount = GlobalThreadCount;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        u32 rowCount = 0;
+        for (u32 i = 0; i < GlobalCapturedZones.size(); ++i)
+            if (GlobalCapturedZones[i].threadIdx == t)
+                rowCount = glm::max(rowCount, GlobalCapturedZones[i].zone.depth + 1);
+
+        // Threads that were idle the whole frame take no space
+        if (rowCount == 0)
+            continue;
+
+        ImGui::TextUnformatted(GlobalCapturedThreadNames[t]);
+        const ImVec2 origin = ImGui::GetCursorScreenPos();
+        ImGui::Dummy(ImVec2(width, rowHeight * rowCount));
+
+        for (u32 i = 0; i < GlobalCapturedZones.size(); ++i)
+        {
+            if (GlobalCapturedZones[i].threadIdx != t)
+                continue;
+
+            // Zones that started in the previous frame are clipped to the frame
+            const ProfileZone& zone = GlobalCapturedZones[i].zone;
+            const u64 zoneBegin = glm::max(zone.begin, GlobalCapturedBegin);
+            const u64 zoneEnd = glm::min(zone.end, GlobalCapturedEnd);
+
+            const ImVec2 min(origin.x + width * (f32)((zoneBegin - GlobalCapturedBegin) / duration), origin.y + rowHeight * zone.depth);
+            const ImVec2 max(origin.x + width * (f32)((zoneEnd - GlobalCapturedBegin) / duration), min.y + rowHeight - 1.0f);
+
+            // The same zone keeps the same color from frame to frame
+            const f32 hue = (HashBytes(zone.name, strlen(zone.name)) % 360) / 360.0f;
+            drawList->AddRectFilled(min, ImVec2(glm::max(max.x, min.x + 1.0f), max.y), ImColor::HSV(hue, 0.5f, 0.7f));
+
+            if (max.x - min.x > ImGui::CalcTextSize(zone.name).x)
+            {
+                drawList->PushClipRect(min, max, true);
+                drawList->AddText(min, IM_COL32_WHITE, zone.name);
+                drawList->PopClipRect();
+            }
+
+            if (ImGui::IsMouseHoveringRect(min, max))
+                ImGui::SetTooltip("%s\n%.3f ms", zone.name, (zone.end - zone.begin) / 1e6);
+        }
+    }
+}
+
+void ProfilerGui()
+{
+    ImGui::Begin("Profiler");
+
+    const u32 frameCount = glm::min(GlobalFrameCount, (u32)PROFILER_FRAME_HISTORY);
+    if (frameCount > 0)
+    {
+        std::vector<f32> sortedFrameTimes(GlobalFrameTimes, GlobalFrameTimes + frameCount);
+        std::sort(sortedFrameTimes.begin(), sortedFrameTimes.end());
+
+        ImGui::Text("Frame time (last %u frames): p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms", frameCount,
+                    Percentile(sortedFrameTimes, 0.50f), Percentile(sortedFrameTimes, 0.95f),
+                    Percentile(sortedFrameTimes, 0.99f), sortedFrameTimes.back());
+
+        // Once the history is full the oldest frame is the next one to be overwritten
+        const u32 oldestFrame = frameCount == PROFILER_FRAME_HISTORY ? GlobalFrameCount % PROFILER_FRAME_HISTORY : 0;
+        ImGui::PlotLines("##FrameTimes", GlobalFrameTimes, frameCount, oldestFrame, "Frame time (ms)",
+                         0.0f, sortedFrameTimes.back() * 1.1f, ImVec2(ImGui::GetContentRegionAvail().x, 80.0f));
+    }
+
+    ImGui::Checkbox("Pause capture", &GlobalPaused);
+    ImGui::SameLine();
+    if (GlobalTrace)
+        ImGui::Text("Capturing trace, %u frames left", GlobalTraceFramesLeft);
+    else if (ImGui::Button("Capture trace (T)"))
+        StartTraceCapture(TRACE_CAPTURE_FRAMES);
+
+    DrawFlameView();
+
+    ImGui::End();
+}
@@ -0,0 +1,67 @@
+//
+// profiler.h: Instrumented CPU profiler. Scoped zones record their begin and end
+// timestamps into a ring buffer owned by the thread that runs them. Once per frame
+// the zones of the last frame are gathered from every thread, to draw them as a
+// flame graph, and the frame time is added to a rolling history. Longer captures
+// can be saved in the Chrome trace event format to inspect them offline.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define PROFILER_ZONES_PER_THREAD 16384
+#define PROFILER_FRAME_HISTORY    256
+#define PROFILER_MAX_THREADS      64
+
+#define TRACE_CAPTURE_FRAMES 300
+
+struct ProfileZone
+{
+    const char* name;   // must outlive the profiler, e.g. a string literal
+    u64         begin;  // ns
+    u64         end;    // ns
+    u32         depth;  // nesting level in its thread
+};
+
+struct ProfileScope
+{
+    ProfileScope(const char* name);
+    ~ProfileScope();
+
+    const char* name;
+    u64         begin;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b)  PROFILE_CONCAT_(a, b)
+
+// Times the rest of the enclosing scope
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+/**
+ * Closes the previous frame: records its duration and, unless the profiler is paused,
+ * captures its zones for the flame view. Called by the main thread at the start of
+ * every frame.
+ */
+void ProfilerBeginFrame();
+
+// Name shown for the calling thread, copied
+void ProfilerSetThreadName(const char* name);
+
+void ProfilerGui();
+
+/**
+ * Records every zone of the next frameCount frames, from all the threads, plus the
+ * GPU scopes, and then writes them from a background thread to a Chrome trace
+ * event file (trace_<time>.json) that chrome://tracing and ui.perfetto.dev open.
+ */
+void StartTraceCapture(u32 frameCount);
+
+bool IsTraceCaptureActive();
+
+// Adds a GPU scope to the capture, with its timestamps already in the CPU clock
+void TraceGpuZone(const char* name, u64 begin, u64 end);
+
+// Waits for the trace file being written, if any
+void ShutdownProfiler();
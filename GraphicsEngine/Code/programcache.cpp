@@ -0,0 +1,115 @@
+#include "programcache.h"
+
+#include <string.h>
+
+static bool ProgramBinarySupported()
+{
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    return formatCount > 0;
+}
+
+u64 MakeProgramCacheKey(String programSource, const char* programName, const char* defines)
+{
+    const char* driverStrings[] = {
+        (const char*)glGetString(GL_VENDOR),
+        (const char*)glGetString(GL_RENDERER),
+        (const char*)glGetString(GL_VERSION)
+    };
+
+    u64 key = HashBytes(programSource.str, programSource.len);
+    key = HashBytes(programName, strlen(programName) + 1, key);
+    key = HashBytes(defines, strlen(defines) + 1, key);
+    for (u32 i = 0; i < ARRAY_COUNT(driverStrings); ++i)
+        if (driverStrings[i])
+            key = HashBytes(driverStrings[i], strlen(driverStrings[i]) + 1, key);
+
+    return key;
+}
+
+GLuint LoadProgramBinary(const char* cachePath, u64 key)
+{
+    if (!ProgramBinarySupported())
+        return 0;
+
+    MappedFile file = MapFile(cachePath);
+    if (!file.data)
+        return 0;
+
+    const ProgramCacheHeader* header = (const ProgramCacheHeader*)file.data;
+    if (file.size < sizeof(ProgramCacheHeader) ||
+        header->magic != PROGRAM_CACHE_MAGIC ||
+        header->version != PROGRAM_CACHE_VERSION ||
+        header->key != key ||
+        file.size < sizeof(ProgramCacheHeader) + header->binarySize)
+    {
+        UnmapFile(file);
+        return 0;
+    }
+
+    GLuint programHandle = glCreateProgram();
+    glProgramBinary(programHandle, header->binaryFormat, header + 1, header->binarySize);
+    UnmapFile(file);
+
+    // Drivers reject binaries they can't use anymore, in which case the program is compiled again
+    GLint success;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glDeleteProgram(programHandle);
+        return 0;
+    }
+
+    return programHandle;
+}
+
+void SaveProgramBinary(const char* cachePath, u64 key, GLuint programHandle)
+{
+    if (!ProgramBinarySupported())
+        return;
+
+    GLint success, binarySize;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    glGetProgramiv(programHandle, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+    if (!success || binarySize <= 0)
+        return;
+
+    std::vector<u8> binary(binarySize);
+    GLenum binaryFormat;
+    glGetProgramBinary(programHandle, binarySize, &binarySize, &binaryFormat, binary.data());
+
+    ProgramCacheHeader header = {};
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.binaryFormat = binaryFormat;
+    header.binarySize = binarySize;
+
+    // Written under a temporary name and moved into place like the mesh cache, a truncated
+    // binary would pass the header check and only fail later in glProgramBinary
+    const std::string tempPath = std::string(cachePath) + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing program cache %s", tempPath.c_str());
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && fwrite(binary.data(), 1, binarySize, file) == (size_t)binarySize;
+    written = fflush(file) == 0 && written;
+    written = fclose(file) == 0 && written;
+
+    if (!written)
+    {
+        ELOG("Failed writing program cache %s", tempPath.c_str());
+        remove(tempPath.c_str());
+        return;
+    }
+
+    if (!MoveFileReplacing(tempPath.c_str(), cachePath))
+    {
+        ELOG("Failed moving program cache %s into place", tempPath.c_str());
+        remove(tempPath.c_str());
+    }
+}
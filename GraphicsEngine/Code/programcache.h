@@ -0,0 +1,34 @@
+//
+// programcache.h: On-disk cache of linked program binaries (glGetProgramBinary), so
+// programs don't need to be compiled again on every launch and hot reload.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define PROGRAM_CACHE_MAGIC   0x474F5250 // "PROG"
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 key;            // MakeProgramCacheKey() of the cached program
+    u32 binaryFormat;
+    u32 binarySize;
+};
+
+/**
+ * Hashes everything that affects the compiled program: the source, the program name,
+ * the extra defines and the driver that compiled it.
+ */
+u64 MakeProgramCacheKey(String programSource, const char* programName, const char* defines);
+
+/**
+ * It returns the program stored in the cache file, or 0 if there is no valid binary
+ * for the given key (e.g. the source changed or the driver was updated).
+ */
+GLuint LoadProgramBinary(const char* cachePath, u64 key);
+
+void SaveProgramBinary(const char* cachePath, u64 key, GLuint programHandle);
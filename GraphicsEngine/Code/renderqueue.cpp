@@ -0,0 +1,113 @@
+#include "renderqueue.h"
+
+#include <algorithm>
+#include <string.h>
+
+#define SORT_KEY_PASS_BITS     4
+#define SORT_KEY_PROGRAM_BITS  8
+#define SORT_KEY_MATERIAL_BITS 16
+#define SORT_KEY_ARENA_BITS    12
+#define SORT_KEY_DEPTH_BITS    24
+
+#define SORT_KEY_DEPTH_SHIFT    0
+#define SORT_KEY_ARENA_SHIFT    (SORT_KEY_DEPTH_SHIFT + SORT_KEY_DEPTH_BITS)
+#define SORT_KEY_MATERIAL_SHIFT (SORT_KEY_ARENA_SHIFT + SORT_KEY_ARENA_BITS)
+#define SORT_KEY_PROGRAM_SHIFT  (SORT_KEY_MATERIAL_SHIFT + SORT_KEY_MATERIAL_BITS)
+#define SORT_KEY_PASS_SHIFT     (SORT_KEY_PROGRAM_SHIFT + SORT_KEY_PROGRAM_BITS)
+
+u64 MakeSortKey(MeshPass pass, u32 programIdx, u32 materialIdx, u32 arenaIdx, f32 viewDepth)
+{
+    ASSERT((u32)pass < (1u << SORT_KEY_PASS_BITS), "Pass does not fit in the sort key");
+    ASSERT(programIdx < (1u << SORT_KEY_PROGRAM_BITS), "Program index does not fit in the sort key");
+    ASSERT(materialIdx < (1u << SORT_KEY_MATERIAL_BITS), "Material index does not fit in the sort key");
+    ASSERT(arenaIdx < (1u << SORT_KEY_ARENA_BITS), "Arena index does not fit in the sort key");
+
+    // Positive floats compare like their bit patterns, so the top bits are a coarser depth
+    u32 depthBits;
+    viewDepth = glm::max(viewDepth, 0.0f);
+    memcpy(&depthBits, &viewDepth, sizeof(depthBits));
+    depthBits >>= 32 - SORT_KEY_DEPTH_BITS;
+
+    return ((u64)pass << SORT_KEY_PASS_SHIFT) |
+           ((u64)programIdx << SORT_KEY_PROGRAM_SHIFT) |
+           ((u64)materialIdx << SORT_KEY_MATERIAL_SHIFT) |
+           ((u64)arenaIdx << SORT_KEY_ARENA_SHIFT) |
+           ((u64)depthBits << SORT_KEY_DEPTH_SHIFT);
+}
+
+void ClearRenderQueue(RenderQueue& queue)
+{
+    queue.items.clear();
+    queue.keys.clear();
+    queue.order.clear();
+}
+
+void PushRenderItem(RenderQueue& queue, u64 key, const RenderItem& item)
+{
+    queue.order.push_back(queue.items.size());
+    queue.items.push_back(item);
+    queue.keys.push_back(key);
+}
+
+void SortRenderQueue(RenderQueue& queue)
+{
+    const u32 count = queue.keys.size();
+    queue.scratchKeys.resize(count);
+    queue.scratchOrder.resize(count);
+
+    RadixSort(queue.keys.data(), queue.order.data(), count, queue.scratchKeys.data(), queue.scratchOrder.data());
+}
+
+void GetRenderQueueRange(const RenderQueue& queue, MeshPass pass, u32* begin, u32* end)
+{
+    const u64 passBegin = (u64)pass << SORT_KEY_PASS_SHIFT;
+    const u64 passEnd = ((u64)pass + 1) << SORT_KEY_PASS_SHIFT;
+
+    *begin = std::lower_bound(queue.keys.begin(), queue.keys.end(), passBegin) - queue.keys.begin();
+    *end = std::lower_bound(queue.keys.begin(), queue.keys.end(), passEnd) - queue.keys.begin();
+}
+
+void RadixSort(u64* keys, u32* values, u32 count, u64* scratchKeys, u32* scratchValues)
+{
+    u64* srcKeys = keys;
+    u32* srcValues = values;
+    u64* dstKeys = scratchKeys;
+    u32* dstValues = scratchValues;
+
+    // One stable counting sort per byte, from the least significant one
+    for (u32 shift = 0; shift < 64 && count > 1; shift += 8)
+    {
+        u32 offsets[256] = {};
+        for (u32 i = 0; i < count; ++i)
+            offsets[(srcKeys[i] >> shift) & 0xff]++;
+
+        // All the keys have the same byte here, this pass would not move anything
+        if (offsets[(srcKeys[0] >> shift) & 0xff] == count)
+            continue;
+
+        u32 sum = 0;
+        for (u32 i = 0; i < 256; ++i)
+        {
+            const u32 digitCount = offsets[i];
+            offsets[i] = sum;
+            sum += digitCount;
+        }
+
+        for (u32 i = 0; i < count; ++i)
+        {
+            const u32 dst = offsets[(srcKeys[i] >> shift) & 0xff]++;
+            dstKeys[dst] = srcKeys[i];
+            dstValues[dst] = srcValues[i];
+        }
+
+        std::swap(srcKeys, dstKeys);
+        std::swap(srcValues, dstValues);
+    }
+
+    // The result ends in the scratch arrays after an odd number of passes
+    if (srcKeys != keys)
+    {
+        memcpy(keys, srcKeys, count * sizeof(u64));
+        memcpy(values, srcValues, count * sizeof(u32));
+    }
+}
@@ -0,0 +1,35 @@
+//
+// renderqueue.h: Per-frame list of draws encoded as 64-bit sort keys. Sorting the
+// keys groups the draws that share state, so consecutive draws rebind as little as
+// possible, and orders the draws with the same state front to back.
+//
+//   63       60 59       52 51             36 35        24 23              0
+//  [   pass   ][  program  ][    material    ][   arena   ][   view depth   ]
+//
+
+#pragma once
+
+#include "engine.h"
+
+/**
+ * Builds the key of a draw. The arena selects the vao and the vertex/index buffers,
+ * and the depth keeps its order through the top 24 bits of its float representation.
+ */
+u64 MakeSortKey(MeshPass pass, u32 programIdx, u32 materialIdx, u32 arenaIdx, f32 viewDepth);
+
+void ClearRenderQueue(RenderQueue& queue);
+
+void PushRenderItem(RenderQueue& queue, u64 key, const RenderItem& item);
+
+/**
+ * Sorts queue.order by key with an LSD radix sort, skipping the bytes every key
+ * shares (most of the pass and program bits in practice).
+ */
+void SortRenderQueue(RenderQueue& queue);
+
+/**
+ * Returns the range of queue.order holding the draws of a pass. Only valid once sorted.
+ */
+void GetRenderQueueRange(const RenderQueue& queue, MeshPass pass, u32* begin, u32* end);
+
+void RadixSort(u64* keys, u32* values, u32 count, u64* scratchKeys, u32* scratchValues);
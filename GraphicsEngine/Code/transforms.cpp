@@ -0,0 +1,240 @@
+#include "transforms.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define TRANSFORMS_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define TARGET_AVX
+    #else
+        #define TARGET_AVX __attribute__((target("avx")))
+    #endif
+#endif
+
+const char* GetTransformKernelName(TransformKernel kernel)
+{
+    switch (kernel)
+    {
+        case TransformKernel_Scalar: return "Scalar";
+        case TransformKernel_SSE:    return "SSE";
+        case TransformKernel_AVX:    return "AVX";
+        default:                     return "Unknown";
+    }
+}
+
+static bool IsAVXSupported()
+{
+#if defined(TRANSFORMS_X86) && defined(_MSC_VER)
+    // CPUID.1:ECX.OSXSAVE[bit 27] and AVX[bit 28], and the OS saves the YMM registers
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#elif defined(TRANSFORMS_X86)
+    return __builtin_cpu_supports("avx");
+#else
+    return false;
+#endif
+}
+
+TransformKernel GetBestTransformKernel()
+{
+#ifdef TRANSFORMS_X86
+    return IsAVXSupported() ? TransformKernel_AVX : TransformKernel_SSE;
+#else
+    return TransformKernel_Scalar;
+#endif
+}
+
+static void TransformScalar(const glm::mat4& viewProjection, const glm::mat4* worldMatrices, const u32* indices, u32 count, u8* output, u32 outputStride,
+                            const glm::vec4* localScaleOffset)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        const glm::mat4& world = worldMatrices[indices ? indices[i] : i];
+        glm::mat4* dst = (glm::mat4*)(output + (u64)i * outputStride);
+        dst[0] = world;
+
+        if (localScaleOffset)
+        {
+            // world * translate(offset) * scale(s): the first three columns are scaled, the last one is world * (offset, 1)
+            const f32 scale = localScaleOffset->w;
+            dst[0][0] = world[0] * scale;
+            dst[0][1] = world[1] * scale;
+            dst[0][2] = world[2] * scale;
+            dst[0][3] = world * glm::vec4(glm::vec3(*localScaleOffset), 1.0f);
+        }
+
+        dst[1] = viewProjection * dst[0];
+    }
+}
+
+#ifdef TRANSFORMS_X86
+
+static void TransformSSE(const glm::mat4& viewProjection, const glm::mat4* worldMatrices, const u32* indices, u32 count, u8* output, u32 outputStride,
+                         const glm::vec4* localScaleOffset)
+{
+    // Matrices are column-major: column j of A*B is A * (column j of B)
+    const float* vp = glm::value_ptr(viewProjection);
+    const __m128 a0 = _mm_loadu_ps(vp + 0);
+    const __m128 a1 = _mm_loadu_ps(vp + 4);
+    const __m128 a2 = _mm_loadu_ps(vp + 8);
+    const __m128 a3 = _mm_loadu_ps(vp + 12);
+
+    const glm::vec4 local = localScaleOffset ? *localScaleOffset : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    const __m128 scale = _mm_set1_ps(local.w);
+    const __m128 offsetX = _mm_set1_ps(local.x);
+    const __m128 offsetY = _mm_set1_ps(local.y);
+    const __m128 offsetZ = _mm_set1_ps(local.z);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        const float* world = glm::value_ptr(worldMatrices[indices ? indices[i] : i]);
+        float* dst = (float*)(output + (u64)i * outputStride);
+
+        __m128 w[4] = { _mm_load_ps(world + 0), _mm_load_ps(world + 4), _mm_load_ps(world + 8), _mm_load_ps(world + 12) };
+
+        // Same folding of translate(offset) * scale(s) as the scalar kernel
+        if (localScaleOffset)
+        {
+            w[3] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w[0], offsetX), _mm_mul_ps(w[1], offsetY)), _mm_add_ps(_mm_mul_ps(w[2], offsetZ), w[3]));
+            w[0] = _mm_mul_ps(w[0], scale);
+            w[1] = _mm_mul_ps(w[1], scale);
+            w[2] = _mm_mul_ps(w[2], scale);
+        }
+
+        for (u32 j = 0; j < 4; ++j)
+        {
+            const __m128 b = w[j];
+            _mm_storeu_ps(dst + 4 * j, b);
+
+            __m128 r =            _mm_mul_ps(a0, _mm_shuffle_ps(b, b, 0x00));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(b, b, 0x55)));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(b, b, 0xAA)));
+            r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(b, b, 0xFF)));
+            _mm_storeu_ps(dst + 16 + 4 * j, r);
+        }
+    }
+}
+
+TARGET_AVX static void TransformAVX(const glm::mat4& viewProjection, const glm::mat4* worldMatrices, const u32* indices, u32 count, u8* output, u32 outputStride,
+                                    const glm::vec4* localScaleOffset)
+{
+    // Same as the SSE kernel, but each 256-bit register holds two columns of the world matrix
+    const float* vp = glm::value_ptr(viewProjection);
+    const __m256 a0 = _mm256_broadcast_ps((const __m128*)(vp + 0));
+    const __m256 a1 = _mm256_broadcast_ps((const __m128*)(vp + 4));
+    const __m256 a2 = _mm256_broadcast_ps((const __m128*)(vp + 8));
+    const __m256 a3 = _mm256_broadcast_ps((const __m128*)(vp + 12));
+
+    const glm::vec4 local = localScaleOffset ? *localScaleOffset : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    const __m256 scale = _mm256_set1_ps(local.w);
+    const __m256 offsetX = _mm256_set1_ps(local.x);
+    const __m256 offsetY = _mm256_set1_ps(local.y);
+    const __m256 offsetZ = _mm256_set1_ps(local.z);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        const float* world = glm::value_ptr(worldMatrices[indices ? indices[i] : i]);
+        float* dst = (float*)(output + (u64)i * outputStride);
+
+        __m256 w[2] = { _mm256_loadu_ps(world), _mm256_loadu_ps(world + 8) };
+
+        // The last column is built in both halves from broadcast columns, and blended into the upper one
+        if (localScaleOffset)
+        {
+            __m256 last = _mm256_add_ps(_mm256_mul_ps(_mm256_broadcast_ps((const __m128*)(world + 0)), offsetX),
+                                        _mm256_mul_ps(_mm256_broadcast_ps((const __m128*)(world + 4)), offsetY));
+            last = _mm256_add_ps(last, _mm256_add_ps(_mm256_mul_ps(_mm256_broadcast_ps((const __m128*)(world + 8)), offsetZ),
+                                                     _mm256_broadcast_ps((const __m128*)(world + 12))));
+            w[0] = _mm256_mul_ps(w[0], scale);
+            w[1] = _mm256_blend_ps(_mm256_mul_ps(w[1], scale), last, 0xF0);
+        }
+
+        for (u32 j = 0; j < 2; ++j)
+        {
+            const __m256 b = w[j];
+            _mm256_storeu_ps(dst + 8 * j, b);
+
+            __m256 r =               _mm256_mul_ps(a0, _mm256_permute_ps(b, 0x00));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(b, 0x55)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(b, 0xAA)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(b, 0xFF)));
+            _mm256_storeu_ps(dst + 16 + 8 * j, r);
+        }
+    }
+
+    _mm256_zeroupper();
+}
+
+#endif
+
+void TransformWorldViewProjection(TransformKernel kernel, const glm::mat4& viewProjection,
+                                  const glm::mat4* worldMatrices, const u32* indices, u32 count,
+                                  void* output, u32 outputStride, const glm::vec4* localScaleOffset)
+{
+    ASSERT(((u64)worldMatrices & 15) == 0, "World matrices must be 16-byte aligned");
+
+    switch (kernel)
+    {
+#ifdef TRANSFORMS_X86
+        case TransformKernel_SSE: TransformSSE(viewProjection, worldMatrices, indices, count, (u8*)output, outputStride, localScaleOffset); break;
+        case TransformKernel_AVX: TransformAVX(viewProjection, worldMatrices, indices, count, (u8*)output, outputStride, localScaleOffset); break;
+#endif
+        default: TransformScalar(viewProjection, worldMatrices, indices, count, (u8*)output, outputStride, localScaleOffset); break;
+    }
+}
+
+void RunTransformBenchmark()
+{
+    const u32 entityCounts[] = { 1000, 100000, 1000000 };
+    const u32 repetitions = 10;
+    const u32 outputStride = 2 * sizeof(glm::mat4);
+
+    const glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.1f, 100.0f) *
+                                     glm::lookAt(glm::vec3(0.0f, 2.0f, 7.5f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    const TransformKernel bestKernel = GetBestTransformKernel();
+
+    for (u32 c = 0; c < ARRAY_COUNT(entityCounts); ++c)
+    {
+        const u32 count = entityCounts[c];
+
+        AlignedVector<glm::mat4> worldMatrices(count);
+        for (u32 i = 0; i < count; ++i)
+            worldMatrices[i] = glm::translate(glm::vec3((f32)(i % 100), (f32)(i / 100 % 100), -(f32)(i / 10000)));
+
+        // Touch the output up front so page faults are not charged to the first path measured
+        u8* output = (u8*)AlignedAlloc((u64)count * outputStride, 64);
+        memset(output, 0, (u64)count * outputStride);
+
+        // Reference: the loop Update() used to run
+        u64 start = GetTimestampNs();
+        for (u32 r = 0; r < repetitions; ++r)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                glm::mat4* dst = (glm::mat4*)(output + (u64)i * outputStride);
+                dst[0] = worldMatrices[i];
+                dst[1] = viewProjection * worldMatrices[i];
+            }
+        }
+        f64 glmMs = (GetTimestampNs() - start) / (1e6 * repetitions);
+        ILOG("Transform benchmark: %7u entities, %-7s %8.3f ms", count, "glm", glmMs);
+
+        for (u32 k = 0; k <= (u32)bestKernel; ++k)
+        {
+            start = GetTimestampNs();
+            for (u32 r = 0; r < repetitions; ++r)
+                TransformWorldViewProjection((TransformKernel)k, viewProjection, worldMatrices.data(), NULL, count, output, outputStride);
+            f64 kernelMs = (GetTimestampNs() - start) / (1e6 * repetitions);
+
+            ILOG("Transform benchmark: %7u entities, %-7s %8.3f ms (%.2fx)", count, GetTransformKernelName((TransformKernel)k), kernelMs, glmMs / kernelMs);
+        }
+
+        AlignedFree(output);
+    }
+}
@@ -0,0 +1,157 @@
+#include "vertexcompression.h"
+#include "culling.h"
+
+#include <glm/gtc/packing.hpp>
+
+// Locations of the attributes written by ProcessAssimpMesh
+#define POSITION_LOCATION  0
+#define NORMAL_LOCATION    1
+#define TEXCOORD_LOCATION  2
+#define TANGENT_LOCATION   3
+#define BITANGENT_LOCATION 4
+
+u32 GetVertexAttributeSize(const VertexBufferAttribute& attribute)
+{
+    switch (attribute.type)
+    {
+        case GL_HALF_FLOAT:
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT: return attribute.componentCount * 2;
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:  return attribute.componentCount;
+        default:                return attribute.componentCount * 4;
+    }
+}
+
+vec2 OctahedralEncode(vec3 n)
+{
+    n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if (n.z >= 0.0f)
+        return vec2(n.x, n.y);
+
+    return (1.0f - glm::abs(vec2(n.y, n.x))) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+void ComputePositionDequantization(const BoundingVolume& bounds, vec3& offset, f32& scale)
+{
+    const vec3 halfExtent = (bounds.aabbMax - bounds.aabbMin) * 0.5f;
+    offset = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+    scale = glm::max(glm::max(halfExtent.x, halfExtent.y), halfExtent.z);
+    if (!(scale > 0.0f))
+        scale = 1.0f;
+}
+
+static const VertexBufferAttribute* FindAttribute(const VertexBufferLayout& layout, u8 location)
+{
+    for (u32 i = 0; i < layout.attributes.size(); ++i)
+        if (layout.attributes[i].location == location)
+            return &layout.attributes[i];
+    return NULL;
+}
+
+static vec3 ReadFloat3(const u8* vertex, const VertexBufferAttribute& attribute)
+{
+    vec3 value;
+    memcpy(&value, vertex + attribute.offset, sizeof(value));
+    return value;
+}
+
+static vec3 SafeNormalize(vec3 v, vec3 fallback)
+{
+    const f32 length = glm::length(v);
+    return length > 1e-12f ? v / length : fallback;
+}
+
+static void WriteOctahedral(u8* data, vec3 n)
+{
+    const vec2 e = OctahedralEncode(n);
+    const u16 packed[2] = { glm::packSnorm1x16(e.x), glm::packSnorm1x16(e.y) };
+    memcpy(data, packed, sizeof(packed));
+}
+
+void CompressSubmeshVertices(Submesh& submesh, vec3 positionOffset, f32 positionScale)
+{
+    const VertexBufferLayout& source = submesh.vertexBufferLayout;
+    const VertexBufferAttribute* position = FindAttribute(source, POSITION_LOCATION);
+    const VertexBufferAttribute* normal = FindAttribute(source, NORMAL_LOCATION);
+    const VertexBufferAttribute* texCoord = FindAttribute(source, TEXCOORD_LOCATION);
+    const VertexBufferAttribute* tangent = FindAttribute(source, TANGENT_LOCATION);
+    const VertexBufferAttribute* bitangent = FindAttribute(source, BITANGENT_LOCATION);
+
+    ASSERT(position && normal, "Compressed vertices need a position and a normal");
+    ASSERT(position->type == GL_FLOAT, "The vertices are already compressed");
+
+    // Position: 3 snorm16 and padding, normal: 2 snorm16
+    VertexBufferLayout layout = {};
+    layout.attributes.push_back(VertexBufferAttribute{ POSITION_LOCATION, 3, 0, GL_SHORT, GL_TRUE });
+    layout.attributes.push_back(VertexBufferAttribute{ NORMAL_LOCATION, 2, 8, GL_SHORT, GL_TRUE });
+    layout.stride = 12;
+
+    // Texture coordinates: 2 halves
+    const u8 texCoordOffset = layout.stride;
+    if (texCoord)
+    {
+        layout.attributes.push_back(VertexBufferAttribute{ TEXCOORD_LOCATION, 2, layout.stride, GL_HALF_FLOAT, GL_FALSE });
+        layout.stride += 4;
+    }
+
+    // Tangent: 2 snorm16 and the sign of the bitangent, plus padding
+    const bool hasTangentSpace = tangent && bitangent;
+    const u8 tangentOffset = layout.stride;
+    if (hasTangentSpace)
+    {
+        layout.attributes.push_back(VertexBufferAttribute{ TANGENT_LOCATION, 3, layout.stride, GL_SHORT, GL_TRUE });
+        layout.stride += 8;
+    }
+
+    ASSERT(layout.stride % sizeof(float) == 0, "Vertices are stored in float arrays");
+
+    const u32 sourceStride = source.stride;
+    const u32 vertexCount = submesh.vertices.size() * sizeof(float) / sourceStride;
+    const u8* sourceData = (const u8*)submesh.vertices.data();
+
+    std::vector<float> vertices(vertexCount * layout.stride / sizeof(float));
+    std::vector<float> positions(vertexCount * 3);
+    u8* data = (u8*)vertices.data();
+
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const u8* sourceVertex = sourceData + i * sourceStride;
+        u8* vertex = data + i * layout.stride;
+
+        const vec3 p = (ReadFloat3(sourceVertex, *position) - positionOffset) / positionScale;
+        const u16 shorts[4] = { glm::packSnorm1x16(p.x), glm::packSnorm1x16(p.y), glm::packSnorm1x16(p.z), 0 };
+        memcpy(vertex, shorts, sizeof(shorts));
+
+        // The bounds must enclose the positions the GPU will see, not the original ones
+        for (u32 c = 0; c < 3; ++c)
+            positions[i * 3 + c] = positionOffset[c] + positionScale * glm::unpackSnorm1x16(shorts[c]);
+
+        const vec3 n = SafeNormalize(ReadFloat3(sourceVertex, *normal), vec3(0.0f, 0.0f, 1.0f));
+        WriteOctahedral(vertex + 8, n);
+
+        if (texCoord)
+        {
+            vec2 uv;
+            memcpy(&uv, sourceVertex + texCoord->offset, sizeof(uv));
+            const u16 uvHalves[2] = { glm::packHalf1x16(uv.x), glm::packHalf1x16(uv.y) };
+            memcpy(vertex + texCoordOffset, uvHalves, sizeof(uvHalves));
+        }
+
+        if (hasTangentSpace)
+        {
+            const vec3 t = SafeNormalize(ReadFloat3(sourceVertex, *tangent), vec3(1.0f, 0.0f, 0.0f));
+            const vec3 b = ReadFloat3(sourceVertex, *bitangent);
+            const f32 sign = glm::dot(glm::cross(n, t), b) < 0.0f ? -1.0f : 1.0f;
+
+            WriteOctahedral(vertex + tangentOffset, t);
+
+            const u16 packedSign[2] = { glm::packSnorm1x16(sign), 0 };
+            memcpy(vertex + tangentOffset + 4, packedSign, sizeof(packedSign));
+        }
+    }
+
+    submesh.vertexBufferLayout = layout;
+    submesh.vertices.swap(vertices);
+    submesh.bounds = ComputeBoundingVolume(positions.data(), vertexCount, 3);
+}
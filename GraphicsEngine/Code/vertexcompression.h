@@ -0,0 +1,57 @@
+//
+// vertexcompression.h: Quantized vertex format for imported meshes. Positions are
+// stored as snorm16 relative to the bounding box of their mesh, texture coordinates as
+// half floats, and normals and tangents as octahedral encoded snorm16 pairs (the
+// bitangent is rebuilt from a sign), which takes the full float vertex of 56 bytes
+// down to 24. The transform kernels fold the dequantization into the matrices of each
+// instance, see GetPositionDequantization.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Imported meshes are compressed and the mesh programs decode them (see VERTEX_COMPRESSION in shaders.glsl)
+#ifndef VERTEX_COMPRESSION
+#define VERTEX_COMPRESSION 1
+#endif
+
+#if VERTEX_COMPRESSION
+#define VERTEX_COMPRESSION_DEFINES "#define VERTEX_COMPRESSION\n"
+#else
+#define VERTEX_COMPRESSION_DEFINES ""
+#endif
+
+u32 GetVertexAttributeSize(const VertexBufferAttribute& attribute);
+
+// Same mapping as OctahedralEncode in shaders.glsl, n must be normalized
+vec2 OctahedralEncode(vec3 n);
+
+/**
+ * Chooses how the positions of a mesh with the given bounds are quantized: relative
+ * to the center of its box, with the same scale on every axis so the normals can
+ * still be transformed by the world matrix and just be renormalized.
+ */
+void ComputePositionDequantization(const BoundingVolume& bounds, vec3& offset, f32& scale);
+
+/**
+ * Converts the float vertices of a submesh (positions at location 0, normals at 1,
+ * and optionally texture coordinates at 2 and tangent/bitangent at 3/4) into the
+ * compressed format, with the positions quantized as (position - offset) / scale.
+ * The bounds are recomputed from the dequantized positions.
+ */
+void CompressSubmeshVertices(Submesh& submesh, vec3 positionOffset, f32 positionScale);
+
+/**
+ * Fills the offset (xyz) and scale (w) which take the compressed positions of the mesh
+ * back to mesh space, as the local transform of TransformWorldViewProjection. Returns
+ * NULL if they are stored as they are.
+ */
+inline const vec4* GetPositionDequantization(const Mesh& mesh, vec4& scaleOffset)
+{
+    if (mesh.positionScale == 1.0f && mesh.positionOffset == vec3(0.0f))
+        return NULL;
+
+    scaleOffset = vec4(mesh.positionOffset, mesh.positionScale);
+    return &scaleOffset;
+}
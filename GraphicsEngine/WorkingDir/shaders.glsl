@@ -32,39 +32,196 @@ void main()
 #endif
 #endif
 
+// -----------------------------------------------------------------
+// LIGHTING (shared by the forward mesh shaders and the deferred lighting pass)
+// -----------------------------------------------------------------
+
+#if defined(SHOW_TEXTURED_MESH) || defined(SHOW_TEXTURED_MESH_INSTANCED) || defined(SHOW_TEXTURED_MESH_INDIRECT) || defined(DEFERRED_LIGHTING)
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3			uCameraPosition;
+	unsigned int	uLightCount;
+	mat4			uViewMatrix;
+	uvec4			uClusterCount;	// xyz: clusters per axis, w: directional light count
+	vec4			uClusterParams;	// x: near plane, y: depth slices per log unit, zw: viewport size
+	mat4			uInverseViewProjectionMatrix;
+};
+
+#if defined(FRAGMENT)
+
+struct Light
+{
+	vec3 color;
+	unsigned int type;
+	vec3 direction;
+	float radius;
+	vec3 position;
+};
+
+// Directional lights first, then point lights
+layout(binding = 3, std430) readonly buffer Lights
+{
+	Light uLights[];
+};
+
+// Offset and count of the light list of every cluster
+layout(binding = 4, std430) readonly buffer Clusters
+{
+	uvec2 uClusters[];
+};
+
+layout(binding = 5, std430) readonly buffer ClusterLights
+{
+	unsigned int uClusterLights[];
+};
+
+uint ClusterIndex(vec3 position)
+{
+	// Depth slices are exponential, tiles are a regular grid in screen space
+	float viewDepth = -(uViewMatrix * vec4(position, 1.0)).z;
+	uint z = uint(clamp(log(viewDepth / uClusterParams.x) * uClusterParams.y, 0.0, float(uClusterCount.z - 1u)));
+	uvec2 xy = min(uvec2(gl_FragCoord.xy / uClusterParams.zw * vec2(uClusterCount.xy)), uClusterCount.xy - 1u);
+	return xy.x + xy.y * uClusterCount.x + z * uClusterCount.x * uClusterCount.y;
+}
+
+// Position, N (normal) and V (direction from pixel to camera) in worldspace
+vec3 ShadeFragment(vec3 albedo, float specularIntensity, float shininess, vec3 position, vec3 N, vec3 V)
+{
+	vec3 specular = vec3(specularIntensity);	// color reflected by mat
+
+	// Ambient
+    float ambientIntensity = 0.25;
+    vec3 ambientColor = albedo * ambientIntensity;
+
+	vec3 diffuseColor = vec3(0.0);
+	vec3 specularColor = vec3(0.0);
+
+	// Directional lights affect every cluster, point lights come from the cluster of the fragment
+	uvec2 cluster = uClusters[ClusterIndex(position)];
+	uint lightCount = uClusterCount.w + cluster.y;
+
+	for(uint i = 0u; i < lightCount; ++i)
+	{
+		Light light = uLights[i < uClusterCount.w ? i : uClusterLights[cluster.x + i - uClusterCount.w]];
+
+	    float attenuation = 1.0f;
+	    vec3 L = normalize(light.direction); // Light direction
+
+		// If it is a point light, attenuate according to distance, reaching zero at its radius
+		if(light.type == 1u)
+		{
+			vec3 toLight = light.position - position;
+			float lightDistance = length(toLight);
+			float falloff = clamp(1.0 - pow(lightDistance / light.radius, 4.0), 0.0, 1.0);
+			attenuation = falloff * falloff / (1.0 + lightDistance * lightDistance);
+			L = toLight / lightDistance;
+		}
+
+	    vec3 R = reflect(-L, N);			// reflected vector
+	    
+	    // Diffuse
+	    float diffuseIntensity = max(0.0, dot(N, L));
+	    diffuseColor += attenuation * albedo * light.color * diffuseIntensity;
+	    
+	    // Specular, skipped for matte materials
+	    if (specularIntensity > 0.0)
+	        specularColor += attenuation * specular * light.color * pow(max(dot(R, V), 0.0), shininess);
+	}
+
+	return ambientColor + diffuseColor + specularColor;
+}
+
+#endif
+
+// Normals (of the G-buffer and of compressed vertices) are stored in two channels,
+// mapping the unit sphere onto an octahedron unfolded on a square
+vec2 OctahedralWrap(vec2 v)
+{
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 OctahedralEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	return n.z >= 0.0 ? n.xy : OctahedralWrap(n.xy);
+}
+
+vec3 OctahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+#endif
+
 // -----------------------------------------------------------------
 // MESH SHADER
 // -----------------------------------------------------------------
 
-#ifdef SHOW_TEXTURED_MESH
+#if defined(SHOW_TEXTURED_MESH) || defined(SHOW_TEXTURED_MESH_INSTANCED) || defined(SHOW_TEXTURED_MESH_INDIRECT)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 layout(location = 0) in vec3 aPosition;
+#if !defined(DEPTH_ONLY)
+#if defined(VERTEX_COMPRESSION)
+layout(location = 1) in vec2 aNormal;	// Octahedral encoded
+#define NORMAL OctahedralDecode(aNormal)
+#else
 layout(location = 1) in vec3 aNormal;
+#define NORMAL aNormal
+#endif
 layout(location = 2) in vec2 aTexCoord;
+#endif
 
-struct Light
+#if defined(SHOW_TEXTURED_MESH_INSTANCED) || defined(SHOW_TEXTURED_MESH_INDIRECT)
+
+struct InstanceParams
 {
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-	unsigned int type;
+	mat4 worldMatrix;
+	mat4 worldViewProjectionMatrix;
 };
 
-layout(binding = 0, std140) uniform GlobalParams
+layout(binding = 2, std430) readonly buffer Instances
 {
-	vec3			uCameraPosition;
-	unsigned int	uLightCount;
-	Light			uLight[16];
+	InstanceParams uInstances[];
 };
 
+#if defined(SHOW_TEXTURED_MESH_INDIRECT)
+layout(location = 5) in uint aInstanceIdx; // baseInstance + gl_InstanceID
+#define INSTANCE_IDX aInstanceIdx
+#else
+#define INSTANCE_IDX gl_InstanceID
+#endif
+
+#define uWorldMatrix				uInstances[INSTANCE_IDX].worldMatrix
+#define uWorldViewProjectionMatrix	uInstances[INSTANCE_IDX].worldViewProjectionMatrix
+
+#else
+
 layout(binding = 1, std140) uniform LocalParams
 {
 	mat4 uWorldMatrix;
 	mat4 uWorldViewProjectionMatrix;
 };
 
+#endif
+
+// The depth pre-pass and the shaded pass are compared with GL_EQUAL, so they must produce the same depth
+invariant gl_Position;
+
+#if defined(DEPTH_ONLY)
+
+void main()
+{
+	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+}
+
+#else
+
 out vec2 vTexCoord;
 out vec3 vPosition; // In worldspace
 out vec3 vNormal;	// In worldspace
@@ -74,75 +231,134 @@ void main()
 {
 	vTexCoord = aTexCoord;
 	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+	vNormal = vec3(uWorldMatrix * vec4(NORMAL, 0.0));
 	vViewDir = uCameraPosition - vPosition;
 	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
 }
 
+#endif
+
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-struct Light
+#if defined(DEPTH_ONLY)
+
+// Depth pre-pass: only the depth buffer is written
+void main()
 {
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-	unsigned int type;
-};
+}
+
+#else
 
 in vec2 vTexCoord;
 in vec3 vPosition; // in worldspace
 in vec3 vNormal; // in worldspace
-in vec3 uViewDir; // in worldspace
+in vec3 vViewDir; // in worldspace
 
 uniform sampler2D uTexture;
+layout(location = 0) uniform float uSmoothness;
+layout(location = 1) uniform float uSpecular;
 
-layout(binding = 0, std140) uniform GlobalParams
+#if defined(GBUFFER)
+
+// Geometry pass of the deferred mode: the position is reconstructed from the depth buffer
+
+layout(location = 0) out vec4 oAlbedoSmoothness;
+layout(location = 1) out vec2 oNormal;
+layout(location = 2) out float oSpecular;
+
+void main()
 {
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[16];
-};
+	oAlbedoSmoothness = vec4(texture(uTexture, vTexCoord).rgb, uSmoothness);
+	oNormal = OctahedralEncode(normalize(vNormal));
+	oSpecular = uSpecular;
+}
+
+#else
 
 layout(location = 0) out vec4 oColor;
 
 void main()
 {	
 	// Mat parameters
-    vec3 specular = vec3(1.0);	// color reflected by mat
-    float shininess = 40.0;		// how strong specular reflections are (more shininess harder and smaller spec)
+    float shininess = max(uSmoothness * 256.0, 1.0);	// same mapping as the deferred lighting pass
 	vec4 albedo = texture(uTexture, vTexCoord);
 
-	// Ambient
-    float ambientIntensity = 0.25;
-    vec3 ambientColor = albedo.xyz * ambientIntensity;
-
     vec3 N = normalize(vNormal);		// normal
-	vec3 V = normalize(-uViewDir.xyz);	// direction from pixel to camera
+	vec3 V = normalize(vViewDir);		// direction from pixel to camera
+
+	oColor = vec4(ShadeFragment(albedo.rgb, uSpecular, shininess, vPosition, N, V), 1.0);
+}
+
+#endif
+#endif
+#endif
+#endif
 
-	vec3 diffuseColor;
-	vec3 specularColor;
+// -----------------------------------------------------------------
+// DEFERRED LIGHTING
+// -----------------------------------------------------------------
 
-	for(int i = 0; i < uLightCount; ++i)
+#ifdef DEFERRED_LIGHTING
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main()
+{
+	// The embedded quad goes from -0.5 to 0.5, scaled up to cover the whole screen
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition.xy * 2.0, 0.0, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec2 vTexCoord;
+
+layout(binding = 0) uniform sampler2D uAlbedoSmoothness;
+layout(binding = 1) uniform sampler2D uNormals;
+layout(binding = 2) uniform sampler2D uDepth;
+layout(binding = 3) uniform sampler2D uSpecular;
+
+// Attachment to show instead of the lit image (GBufferView in engine.h)
+layout(location = 0) uniform int uView;
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+	vec4 albedoSmoothness = texture(uAlbedoSmoothness, vTexCoord);
+	vec3 N = OctahedralDecode(texture(uNormals, vTexCoord).xy);
+	float depth = texture(uDepth, vTexCoord).r;
+
+	// Worldspace position from the depth buffer
+	vec4 position = uInverseViewProjectionMatrix * vec4(vec3(vTexCoord, depth) * 2.0 - 1.0, 1.0);
+	position.xyz /= position.w;
+
+	if (uView == 1)
+		oColor = vec4(albedoSmoothness.rgb, 1.0);
+	else if (uView == 2)
+		oColor = vec4(vec3(albedoSmoothness.a), 1.0);
+	else if (uView == 3)
+		oColor = vec4(N * 0.5 + 0.5, 1.0);
+	else if (uView == 4)
+		oColor = vec4(vec3(1.0 - exp(-0.1 * length(position.xyz - uCameraPosition))), 1.0);
+	else if (uView == 5)
+		oColor = vec4(fract(position.xyz), 1.0);
+	else if (uView == 6)
+		oColor = vec4(vec3(texture(uSpecular, vTexCoord).r), 1.0);
+	else if (depth == 1.0)
+		oColor = vec4(0.1, 0.1, 0.1, 1.0); // Background
+	else
 	{
-	    float attenuation = 1.0f;
-		
-		// If it is a point light, attenuate according to distance
-		if(uLight[i].type == 1)
-			attenuation = 2.0 / length(uLight[i].position - vPosition);
-	        
-	    vec3 L = normalize(uLight[i].direction - uViewDir.xyz); // Light direction 
-	    vec3 R = reflect(-L, N);								// reflected vector
-	    
-	    // Diffuse
-	    float diffuseIntensity = max(0.0, dot(N, L));
-	    diffuseColor += attenuation * albedo.xyz * uLight[i].color * diffuseIntensity;
-	    
-	    // Specular
-	    float specularIntensity = pow(max(dot(R, V), 0.0), shininess);
-	    specularColor += attenuation * specular * uLight[i].color * specularIntensity;
+		float shininess = max(albedoSmoothness.a * 256.0, 1.0);
+		vec3 V = normalize(uCameraPosition - position.xyz);
+		float specular = texture(uSpecular, vTexCoord).r;
+		oColor = vec4(ShadeFragment(albedoSmoothness.rgb, specular, shininess, position.xyz, N, V), 1.0);
 	}
-
-	oColor = vec4(ambientColor + diffuseColor + specularColor, 1.0);
 }
 
 #endif